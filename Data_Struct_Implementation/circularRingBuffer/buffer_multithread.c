@@ -1,75 +1,178 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
-#include <signal.h> 
+#include <signal.h>
 #include <stdint.h>
-#include <semaphore.h>
-#include <unistd.h>
+#include <sched.h>
 
-#include "ring_buffer.h"
+#include "buffer_multithread.h"
 
-static uint32_t ringBuffer[RING_BUFFER_SIZE];
-static volatile uint32_t headIdx;
-volatile sig_atomic_t done = 0;
+static inline mpmcSlot_t *mpmcSlot(mpmcQueue_t *q, uint32_t pos) {
+    return (mpmcSlot_t *)(q->slots + (size_t)(pos & q->mask) * q->slotSize);
+}
+
+int mpmcQueueInit(mpmcQueue_t *q, uint32_t elemSize, uint32_t capacity) {
+    uint32_t i;
+
+    if(capacity < 2 || (capacity & (capacity - 1)) || elemSize == 0) {
+        return -1;
+    }
+
+    // keep every slot's sequence number naturally aligned
+    q->slotSize = (sizeof(mpmcSlot_t) + elemSize + sizeof(uint32_t) - 1) & ~(uint32_t)(sizeof(uint32_t) - 1);
+    q->slots = aligned_alloc(CACHE_LINE_SIZE,
+            ((size_t)q->slotSize * capacity + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1));
+    if(q->slots == NULL) {
+        return -1;
+    }
+
+    q->mask = capacity - 1;
+    q->elemSize = elemSize;
+    for(i = 0; i < capacity; i++) {
+        atomic_init(&mpmcSlot(q, i)->seq, i);
+    }
+    atomic_init(&q->enqueuePos, 0);
+    atomic_init(&q->dequeuePos, 0);
+
+    return 0;
+}
+
+void mpmcQueueFree(mpmcQueue_t *q) {
+    free(q->slots);
+    q->slots = NULL;
+}
 
-pthread_mutex_t mtx;
-sem_t sem_w, sem_r;
+uint32_t mpmcTryWriteToBuffer(mpmcQueue_t *q, const void *data) {
+    uint32_t pos = atomic_load_explicit(&q->enqueuePos, memory_order_relaxed);
+    mpmcSlot_t *slot;
+
+    for(;;) {
+        slot = mpmcSlot(q, pos);
+        int32_t diff = (int32_t)(atomic_load_explicit(&slot->seq, memory_order_acquire) - pos);
+
+        if(diff == 0) {
+            // slot is free for this lap, try to claim the position
+            if(atomic_compare_exchange_weak_explicit(&q->enqueuePos, &pos, pos + 1,
+                        memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if(diff < 0) {
+            // consumer of the previous lap has not released it yet: full
+            return ACCESS_FAIL;
+        } else {
+            // another producer took this position, reload
+            pos = atomic_load_explicit(&q->enqueuePos, memory_order_relaxed);
+        }
+    }
+
+    memcpy(slot->data, data, q->elemSize);
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    return ACCESS_SUCCESS;
+}
 
-void ringBufferInit() {
-    headIdx = 0;
+uint32_t mpmcTryReadFromBuffer(mpmcQueue_t *q, void *data) {
+    uint32_t pos = atomic_load_explicit(&q->dequeuePos, memory_order_relaxed);
+    mpmcSlot_t *slot;
+
+    for(;;) {
+        slot = mpmcSlot(q, pos);
+        int32_t diff = (int32_t)(atomic_load_explicit(&slot->seq, memory_order_acquire) - (pos + 1));
+
+        if(diff == 0) {
+            if(atomic_compare_exchange_weak_explicit(&q->dequeuePos, &pos, pos + 1,
+                        memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if(diff < 0) {
+            // producer has not filled it yet: empty
+            return ACCESS_FAIL;
+        } else {
+            pos = atomic_load_explicit(&q->dequeuePos, memory_order_relaxed);
+        }
+    }
+
+    memcpy(data, slot->data, q->elemSize);
+    // hand the slot to the producer of the next lap
+    atomic_store_explicit(&slot->seq, pos + q->mask + 1, memory_order_release);
+
+    return ACCESS_SUCCESS;
 }
 
-uint32_t writeToBuffer(int data) {
-    sem_wait(&sem_w);
+uint32_t mpmcWriteToBuffer(mpmcQueue_t *q, const void *data) {
+    uint32_t spins = 0;
 
-    pthread_mutex_lock(&mtx);
-    ringBuffer[headIdx] = data;
-    headIdx++;
-    printf("Wrote value %d, headIdx: %d\n", data, headIdx);
-    pthread_mutex_unlock(&mtx);
+    while(mpmcTryWriteToBuffer(q, data) == ACCESS_FAIL) {
+        if(++spins < MPMC_SPIN_LIMIT) {
+            cpuRelax();
+        } else {
+            sched_yield();
+        }
+    }
 
-    sem_post(&sem_r);
-    
     return ACCESS_SUCCESS;
 }
 
-uint32_t readFromBuffer(int *data) {
-    sem_wait(&sem_r);
-    
-    pthread_mutex_lock(&mtx);
-    headIdx--;
-    *data = ringBuffer[headIdx];
-    printf("Read value %d headIdx: %d\n", *data, headIdx);
-    pthread_mutex_unlock(&mtx);
-    
-    sem_post(&sem_w);
+uint32_t mpmcReadFromBuffer(mpmcQueue_t *q, void *data) {
+    uint32_t spins = 0;
+
+    while(mpmcTryReadFromBuffer(q, data) == ACCESS_FAIL) {
+        if(++spins < MPMC_SPIN_LIMIT) {
+            cpuRelax();
+        } else {
+            sched_yield();
+        }
+    }
 
     return ACCESS_SUCCESS;
 }
 
-void *readHandler(void *max) 
+/* Demo, left out when the queue is linked into ring_bench */
+#ifndef RING_BUFFER_NO_MAIN
+typedef struct {
+    mpmcQueue_t *q;
+    uint32_t id;
+    uint32_t maxNum;
+    uint64_t sum;
+} threadArg_t;
+
+/* Elements are (producer id << 32 | counter), counters start at 1 */
+void *readHandler(void *arg)
 {
-    int maxNum = (int) max;
-    int buffer, r;
+    threadArg_t *t = arg;
+    uint32_t lastSeen[MAX_NUM_OF_THREADS] = {0};
+    uint64_t buffer;
+    uint32_t i;
 
-    while(maxNum) {
-        r = readFromBuffer(&buffer);
-        if(r == ACCESS_SUCCESS) {
-            maxNum--;
+    for(i = 0; i < t->maxNum; i++) {
+        mpmcReadFromBuffer(t->q, &buffer);
+
+        uint32_t producer = buffer >> 32;
+        uint32_t counter = (uint32_t)buffer;
+
+        // FIFO: elements of one producer must come out in order
+        if(producer >= MAX_NUM_OF_THREADS || counter <= lastSeen[producer]) {
+            printf("ERROR: consumer %u read %u from producer %u after %u\n",
+                    t->id, counter, producer, lastSeen[producer]);
+            exit(EXIT_FAILURE);
         }
+        lastSeen[producer] = counter;
+        t->sum += counter;
     }
 
     pthread_exit(NULL);
 }
 
-void *writeHandler(void *max)
+void *writeHandler(void *arg)
 {
-    int r;
-    int maxNum = (int) max;
+    threadArg_t *t = arg;
+    uint64_t buffer;
+    uint32_t counter;
 
-    while(maxNum) {
-        r = writeToBuffer(maxNum);
-        maxNum--;
+    for(counter = 1; counter <= t->maxNum; counter++) {
+        buffer = ((uint64_t)t->id << 32) | counter;
+        mpmcWriteToBuffer(t->q, &buffer);
     }
 
     pthread_exit(NULL);
@@ -78,54 +181,69 @@ void *writeHandler(void *max)
 void handle_sigint(int sig)
 {
     printf("Caught signal %d\n", sig);
-    done = 1;
+    exit(EXIT_FAILURE);
 }
 
 
 int main(int argc, char **argv) {
     int ret, i;
-    int target = atoi(argv[1]);
-    ringBufferInit();
+    uint64_t sum = 0;
+    mpmcQueue_t q;
+    threadArg_t producerArgs[MAX_NUM_OF_THREADS];
+    threadArg_t consumerArgs[MAX_NUM_OF_THREADS];
     pthread_t producer_threads[MAX_NUM_OF_THREADS];
     pthread_t consumer_threads[MAX_NUM_OF_THREADS];
 
+    if(argc < 2) {
+        printf("Usage: %s <count per producer>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(mpmcQueueInit(&q, sizeof(uint64_t), RING_BUFFER_SIZE)) {
+        printf("ERROR: queue init failure\n");
+        exit(EXIT_FAILURE);
+    }
+
     signal(SIGINT, handle_sigint);
 
-    pthread_mutex_init(&mtx, 0);
-    sem_init(&sem_w, 0, RING_BUFFER_SIZE);
-    sem_init(&sem_r, 0, 0);
-    
     for (i = 0; i < MAX_NUM_OF_THREADS; i++) {
-        ret = pthread_create(&consumer_threads[i], NULL, writeHandler, (void *) target);
+        consumerArgs[i] = (threadArg_t){ .q = &q, .id = i, .maxNum = atoi(argv[1]) };
+        ret = pthread_create(&consumer_threads[i], NULL, readHandler, &consumerArgs[i]);
         if(ret) {
             printf("ERROR: Reading thread creation failure\n");
             exit(EXIT_FAILURE);
         } else {
-            printf("writing thread created\n");
+            printf("reading thread created\n");
         }
     }
 
     for (i = 0; i < MAX_NUM_OF_THREADS; i++) {
-        ret = pthread_create(&producer_threads[i], NULL, readHandler, (void *) target);
+        producerArgs[i] = (threadArg_t){ .q = &q, .id = i, .maxNum = atoi(argv[1]) };
+        ret = pthread_create(&producer_threads[i], NULL, writeHandler, &producerArgs[i]);
         if(ret) {
-            printf("ERROR: Reading thread creation failure\n");
+            printf("ERROR: Writing thread creation failure\n");
             exit(EXIT_FAILURE);
         } else {
-            printf("reading thread created\n");
+            printf("writing thread created\n");
         }
     }
 
     for (i = 0; i < MAX_NUM_OF_THREADS; i++) {
         pthread_join(producer_threads[i], NULL);
         pthread_join(consumer_threads[i], NULL);
+        sum += consumerArgs[i].sum;
     }
 
-    pthread_mutex_destroy(&mtx);
+    // every producer wrote 1..maxNum exactly once
+    if(sum != (uint64_t)MAX_NUM_OF_THREADS * producerArgs[0].maxNum * (producerArgs[0].maxNum + 1) / 2) {
+        printf("ERROR: checksum mismatch\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("%d producers/%d consumers moved %u values each in FIFO order\n",
+            MAX_NUM_OF_THREADS, MAX_NUM_OF_THREADS, producerArgs[0].maxNum);
+
+    mpmcQueueFree(&q);
 
     return 0;
 }
-
-
-
-
-
+#endif
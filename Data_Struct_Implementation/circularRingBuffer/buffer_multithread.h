@@ -0,0 +1,42 @@
+#pragma once
+
+#include "ring_buffer.h"
+
+#define MPMC_SPIN_LIMIT     64 // spins before a full/empty queue starts yielding
+
+/*
+Bounded multi-producer/multi-consumer FIFO (per-slot sequence numbers).
+
+Every slot carries a sequence number that tells whose turn it is:
+  seq == pos       the slot is free for the producer claiming position pos
+  seq == pos + 1   the slot holds the element written at position pos
+Producers and consumers claim a position with one CAS on their own
+counter and then only touch that slot, so contention is spread across
+slots instead of serialised on a single lock.
+*/
+typedef struct {
+    _Atomic uint32_t seq;
+    uint8_t data[];
+} mpmcSlot_t;
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t enqueuePos;
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t dequeuePos;
+
+    // read-only after mpmcQueueInit()
+    _Alignas(CACHE_LINE_SIZE) uint32_t mask;
+    uint32_t elemSize;
+    uint32_t slotSize;
+    uint8_t *slots;
+} mpmcQueue_t;
+
+int mpmcQueueInit(mpmcQueue_t *q, uint32_t elemSize, uint32_t capacity);
+void mpmcQueueFree(mpmcQueue_t *q);
+
+/* Non-blocking, return ACCESS_FAIL when full/empty */
+uint32_t mpmcTryWriteToBuffer(mpmcQueue_t *q, const void *data);
+uint32_t mpmcTryReadFromBuffer(mpmcQueue_t *q, void *data);
+
+/* Block (spin, then yield) only while the queue is full/empty */
+uint32_t mpmcWriteToBuffer(mpmcQueue_t *q, const void *data);
+uint32_t mpmcReadFromBuffer(mpmcQueue_t *q, void *data);
@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "byte_ring.h"
+
+static inline uint32_t recordSize(uint32_t len) {
+    return (sizeof(byteRecord_t) + len + BYTE_RING_ALIGN - 1) & ~(uint32_t)(BYTE_RING_ALIGN - 1);
+}
+
+static inline byteRecord_t *recordAt(byteRing_t *br, uint32_t idx) {
+    return (byteRecord_t *)(br->buffer + (idx & br->mask));
+}
+
+int byteRingInit(byteRing_t *br, uint32_t capacity) {
+    // half the ring minus a header still holds BYTE_RING_ALIGN bytes, see byteRingMaxRecord()
+    if(capacity < 4 * BYTE_RING_ALIGN || (capacity & (capacity - 1)) || capacity > (1u << 30)) {
+        return -1;
+    }
+
+    br->buffer = aligned_alloc(CACHE_LINE_SIZE, capacity < CACHE_LINE_SIZE ? CACHE_LINE_SIZE : capacity);
+    if(br->buffer == NULL) {
+        return -1;
+    }
+
+    br->mask = capacity - 1;
+    atomic_init(&br->headIdx, 0);
+    atomic_init(&br->tailIdx, 0);
+    br->cachedHeadIdx = 0;
+    br->cachedTailIdx = 0;
+    br->reserveLen = 0;
+    br->peekLen = 0;
+
+    return 0;
+}
+
+void byteRingFree(byteRing_t *br) {
+    free(br->buffer);
+    br->buffer = NULL;
+}
+
+/* Producer side only */
+void *byteRingReserve(byteRing_t *br, uint32_t len) {
+    uint32_t head = atomic_load_explicit(&br->headIdx, memory_order_relaxed);
+    uint32_t capacity = br->mask + 1;
+    uint32_t need, contiguous, pad;
+
+    // bigger records may never fit, and recordSize() would wrap near UINT32_MAX
+    if(len > byteRingMaxRecord(br)) {
+        return NULL;
+    }
+
+    need = recordSize(len);
+    contiguous = capacity - (head & br->mask);
+    pad = need > contiguous ? contiguous : 0;
+
+    if(capacity - (head - br->cachedTailIdx) < pad + need) {
+        br->cachedTailIdx = atomic_load_explicit(&br->tailIdx, memory_order_acquire);
+        if(capacity - (head - br->cachedTailIdx) < pad + need) {
+            return NULL;
+        }
+    }
+
+    // skip the end of the buffer, the consumer drops this record
+    if(pad) {
+        byteRecord_t *r = recordAt(br, head);
+        r->len = pad - sizeof(byteRecord_t);
+        r->type = RECORD_PAD;
+    }
+
+    br->reserveIdx = head + pad;
+    br->reserveLen = len;
+
+    return recordAt(br, br->reserveIdx) + 1;
+}
+
+/* Producer side only */
+void byteRingCommit(byteRing_t *br, uint32_t len) {
+    byteRecord_t *r = recordAt(br, br->reserveIdx);
+
+    if(len > br->reserveLen) {
+        len = br->reserveLen;
+    }
+
+    r->len = len;
+    r->type = RECORD_DATA;
+    // release: header, padding and payload are visible before the new head
+    atomic_store_explicit(&br->headIdx, br->reserveIdx + recordSize(len), memory_order_release);
+    br->reserveLen = 0;
+}
+
+/* Consumer side only */
+void *byteRingPeek(byteRing_t *br, uint32_t *len) {
+    uint32_t tail = atomic_load_explicit(&br->tailIdx, memory_order_relaxed);
+    byteRecord_t *r;
+
+    for(;;) {
+        if(tail == br->cachedHeadIdx) {
+            br->cachedHeadIdx = atomic_load_explicit(&br->headIdx, memory_order_acquire);
+            if(tail == br->cachedHeadIdx) {
+                return NULL;
+            }
+        }
+
+        r = recordAt(br, tail);
+        if(r->type != RECORD_PAD) {
+            break;
+        }
+
+        // wrap point, hand the padding back right away
+        tail += recordSize(r->len);
+        atomic_store_explicit(&br->tailIdx, tail, memory_order_release);
+    }
+
+    br->peekLen = r->len;
+    *len = r->len;
+
+    return r + 1;
+}
+
+/* Consumer side only */
+void byteRingRelease(byteRing_t *br) {
+    uint32_t tail = atomic_load_explicit(&br->tailIdx, memory_order_relaxed);
+
+    atomic_store_explicit(&br->tailIdx, tail + recordSize(br->peekLen), memory_order_release);
+}
+
+/* Demo, left out when the queue is linked into ring_bench */
+#ifndef RING_BUFFER_NO_MAIN
+#define DEMO_MAX_RECORD     300
+
+/* Record n has a length and contents derived from n so the reader can check it */
+static uint32_t demoLen(uint32_t n) {
+    return 1 + (n * 37) % DEMO_MAX_RECORD;
+}
+
+typedef struct {
+    byteRing_t *br;
+    uint32_t maxNum;
+} threadArg_t;
+
+void *readHandler(void *arg)
+{
+    threadArg_t *t = arg;
+    uint32_t n, i, len;
+    uint8_t *msg;
+
+    for(n = 0; n < t->maxNum; ) {
+        msg = byteRingPeek(t->br, &len);
+        if(msg == NULL) {
+            cpuRelax();
+            continue;
+        }
+
+        // parse in place, no copy out of the ring
+        if(len != demoLen(n)) {
+            printf("ERROR: record %u has length %u, expected %u\n", n, len, demoLen(n));
+            exit(EXIT_FAILURE);
+        }
+        for(i = 0; i < len; i++) {
+            if(msg[i] != (uint8_t)(n + i)) {
+                printf("ERROR: record %u corrupted at byte %u\n", n, i);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        byteRingRelease(t->br);
+        n++;
+    }
+
+    printf("Read %u records in order\n", t->maxNum);
+    pthread_exit(NULL);
+}
+
+void *writeHandler(void *arg)
+{
+    threadArg_t *t = arg;
+    uint32_t n, i, len;
+    uint8_t *msg;
+
+    for(n = 0; n < t->maxNum; ) {
+        len = demoLen(n);
+        msg = byteRingReserve(t->br, len);
+        if(msg == NULL) {
+            cpuRelax();
+            continue;
+        }
+
+        // build the message directly in the ring
+        for(i = 0; i < len; i++) {
+            msg[i] = (uint8_t)(n + i);
+        }
+
+        byteRingCommit(t->br, len);
+        n++;
+    }
+
+    pthread_exit(NULL);
+}
+
+/* The largest record must fit even when it has to wrap, anything bigger is refused */
+static void demoLimits(void)
+{
+    byteRing_t br;
+    uint32_t len, max;
+
+    if(byteRingInit(&br, BYTE_RING_SIZE)) {
+        printf("ERROR: byte ring init failure\n");
+        exit(EXIT_FAILURE);
+    }
+    max = byteRingMaxRecord(&br);
+
+    // move the head just past the middle, the next big record needs a pad
+    byteRingReserve(&br, max);
+    byteRingCommit(&br, max);
+    byteRingReserve(&br, 1);
+    byteRingCommit(&br, 1);
+    while(byteRingPeek(&br, &len) != NULL) {
+        byteRingRelease(&br);
+    }
+
+    if(byteRingReserve(&br, max + 1) != NULL || byteRingReserve(&br, UINT32_MAX) != NULL) {
+        printf("ERROR: record above %u bytes accepted\n", max);
+        exit(EXIT_FAILURE);
+    }
+    if(byteRingReserve(&br, max) == NULL) {
+        printf("ERROR: %u byte record refused by an empty ring\n", max);
+        exit(EXIT_FAILURE);
+    }
+    byteRingCommit(&br, max);
+    if(byteRingPeek(&br, &len) == NULL || len != max) {
+        printf("ERROR: wrapped %u byte record lost\n", max);
+        exit(EXIT_FAILURE);
+    }
+    byteRingRelease(&br);
+
+    printf("Records up to %u bytes fit a %u byte ring\n", max, BYTE_RING_SIZE);
+    byteRingFree(&br);
+}
+
+void handle_sigint(int sig)
+{
+    printf("Caught signal %d\n", sig);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char **argv) {
+    int ret;
+    byteRing_t br;
+    threadArg_t arg;
+    pthread_t threads[MAX_NUM_OF_THREADS];
+
+    if(argc < 2) {
+        printf("Usage: %s <count>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    demoLimits();
+
+    if(byteRingInit(&br, BYTE_RING_SIZE)) {
+        printf("ERROR: byte ring init failure\n");
+        exit(EXIT_FAILURE);
+    }
+    arg.br = &br;
+    arg.maxNum = atoi(argv[1]);
+
+    signal(SIGINT, handle_sigint);
+
+    ret = pthread_create(&threads[READ_THREAD_IDX], NULL, readHandler, &arg);
+    if(ret) {
+        printf("ERROR: Reading thread creation failure\n");
+        exit(EXIT_FAILURE);
+    } else {
+        printf("reading thread created\n");
+    }
+
+    ret = pthread_create(&threads[WRITE_THREAD_IDX], NULL, writeHandler, &arg);
+    if(ret) {
+        printf("ERROR: Writing thread creation failure\n");
+        exit(EXIT_FAILURE);
+    } else {
+        printf("writing thread created\n");
+    }
+
+    pthread_join(threads[READ_THREAD_IDX], NULL);
+    pthread_join(threads[WRITE_THREAD_IDX], NULL);
+
+    byteRingFree(&br);
+
+    return 0;
+}
+#endif
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "ring_buffer.h"
+
+#define BYTE_RING_SIZE      4096 // bytes, must be a power of two
+#define BYTE_RING_ALIGN     8
+#define RECORD_DATA         0
+#define RECORD_PAD          1
+
+/*
+Every record starts with this header and is padded to BYTE_RING_ALIGN,
+so payloads are always 8-byte aligned. When a record does not fit
+before the end of the buffer the producer fills the tail with a
+RECORD_PAD record and starts the record at offset 0, so a payload is
+always one contiguous span.
+*/
+typedef struct {
+    uint32_t len;
+    uint32_t type;
+} byteRecord_t;
+
+/*
+Single-producer/single-consumer ring of variable-length records. The
+producer writes messages in place (reserve/commit) and the consumer
+reads them in place (peek/release), no intermediate copies.
+*/
+typedef struct {
+    // producer side
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t headIdx;
+    uint32_t cachedTailIdx;
+    uint32_t reserveIdx;    // offset of the reserved record
+    uint32_t reserveLen;    // payload bytes reserved
+
+    // consumer side
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t tailIdx;
+    uint32_t cachedHeadIdx;
+    uint32_t peekLen;       // payload bytes of the peeked record
+
+    // read-only after byteRingInit()
+    _Alignas(CACHE_LINE_SIZE) uint32_t mask;
+    uint8_t *buffer;
+} byteRing_t;
+
+int byteRingInit(byteRing_t *br, uint32_t capacity);
+void byteRingFree(byteRing_t *br);
+
+/*
+Largest len byteRingReserve() accepts: half the ring minus the header.
+A record that does not fit before the end of the buffer also needs the
+padding in front of it, which is smaller than the record, so a record of
+at most half the ring always fits once the consumer has caught up.
+*/
+static inline uint32_t byteRingMaxRecord(const byteRing_t *br) {
+    return (br->mask + 1) / 2 - sizeof(byteRecord_t);
+}
+
+/* Producer: get len bytes to write into, NULL when there is no room
+   or len is above byteRingMaxRecord() and never will fit */
+void *byteRingReserve(byteRing_t *br, uint32_t len);
+/* Producer: publish the reserved record, len may shrink the reservation */
+void byteRingCommit(byteRing_t *br, uint32_t len);
+
+/* Consumer: oldest record and its length, NULL when empty */
+void *byteRingPeek(byteRing_t *br, uint32_t *len);
+/* Consumer: drop the peeked record so the producer can reuse the space */
+void byteRingRelease(byteRing_t *br);
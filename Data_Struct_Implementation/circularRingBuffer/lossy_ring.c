@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sched.h>
+
+#include "lossy_ring.h"
+
+#define WORD_SIZE   sizeof(uint64_t)
+
+static inline lossySlot_t *slotAt(lossyRing_t *lr, uint64_t pos) {
+    return (lossySlot_t *)(lr->slots + (size_t)(pos & lr->mask) * lr->slotSize);
+}
+
+int lossyRingInit(lossyRing_t *lr, uint32_t elemSize, uint32_t capacity) {
+    uint32_t i;
+
+    if(capacity == 0 || (capacity & (capacity - 1)) || elemSize == 0) {
+        return -1;
+    }
+
+    lr->slotSize = sizeof(lossySlot_t) + ((elemSize + WORD_SIZE - 1) & ~(uint32_t)(WORD_SIZE - 1));
+    lr->slots = aligned_alloc(CACHE_LINE_SIZE,
+            ((size_t)lr->slotSize * capacity + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1));
+    if(lr->slots == NULL) {
+        return -1;
+    }
+
+    lr->mask = capacity - 1;
+    lr->elemSize = elemSize;
+    for(i = 0; i < capacity; i++) {
+        // 0 is below any valid "written" value 2 * pos + 2
+        atomic_init(&slotAt(lr, i)->seq, 0);
+    }
+    atomic_init(&lr->headIdx, 0);
+
+    return 0;
+}
+
+void lossyRingFree(lossyRing_t *lr) {
+    free(lr->slots);
+    lr->slots = NULL;
+}
+
+static void copyIn(lossyRing_t *lr, lossySlot_t *slot, const uint8_t *src) {
+    uint32_t off, left;
+    uint64_t word;
+
+    for(off = 0; off < lr->elemSize; off += WORD_SIZE) {
+        left = lr->elemSize - off;
+        word = 0;
+        memcpy(&word, src + off, left < WORD_SIZE ? left : WORD_SIZE);
+        atomic_store_explicit(&slot->data[off / WORD_SIZE], word, memory_order_relaxed);
+    }
+}
+
+static void copyOut(lossyRing_t *lr, lossySlot_t *slot, uint8_t *dst) {
+    uint32_t off, left;
+    uint64_t word;
+
+    for(off = 0; off < lr->elemSize; off += WORD_SIZE) {
+        left = lr->elemSize - off;
+        word = atomic_load_explicit(&slot->data[off / WORD_SIZE], memory_order_relaxed);
+        memcpy(dst + off, &word, left < WORD_SIZE ? left : WORD_SIZE);
+    }
+}
+
+/* Writer side only */
+void lossyWriteToBuffer(lossyRing_t *lr, const void *data) {
+    uint64_t pos = atomic_load_explicit(&lr->headIdx, memory_order_relaxed);
+    lossySlot_t *slot = slotAt(lr, pos);
+
+    // mark the slot busy before any payload word changes
+    atomic_store_explicit(&slot->seq, 2 * pos + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    copyIn(lr, slot, data);
+
+    atomic_store_explicit(&slot->seq, 2 * pos + 2, memory_order_release);
+    atomic_store_explicit(&lr->headIdx, pos + 1, memory_order_release);
+}
+
+void lossyReaderInit(lossyRing_t *lr, lossyReader_t *reader) {
+    reader->pos = atomic_load_explicit(&lr->headIdx, memory_order_acquire);
+    reader->missed = 0;
+}
+
+uint32_t lossyReadFromBuffer(lossyRing_t *lr, lossyReader_t *reader, void *data) {
+    uint64_t capacity = (uint64_t)lr->mask + 1;
+    uint64_t expected, seq, head, oldest;
+    lossySlot_t *slot;
+
+    for(;;) {
+        slot = slotAt(lr, reader->pos);
+        expected = 2 * reader->pos + 2;
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+        // not written yet, or the writer is filling it right now
+        if(seq < expected) {
+            return ACCESS_FAIL;
+        }
+
+        if(seq == expected) {
+            copyOut(lr, slot, data);
+
+            // the copy is only good if nobody started rewriting the slot meanwhile
+            atomic_thread_fence(memory_order_acquire);
+            if(atomic_load_explicit(&slot->seq, memory_order_relaxed) == expected) {
+                reader->pos++;
+                return ACCESS_SUCCESS;
+            }
+        }
+
+        // overwritten or torn: skip to the oldest sample still in the ring
+        head = atomic_load_explicit(&lr->headIdx, memory_order_acquire);
+        oldest = head > capacity ? head - capacity : 0;
+        if(oldest <= reader->pos) {
+            oldest = reader->pos + 1;
+        }
+        reader->missed += oldest - reader->pos;
+        reader->pos = oldest;
+    }
+}
+
+/* Demo, left out when the queue is linked into ring_bench */
+#ifndef RING_BUFFER_NO_MAIN
+#define DEMO_RING_SIZE      64
+#define DEMO_WORK_LOOPS     2000 // make the reader slower than the writer
+
+typedef struct {
+    lossyRing_t *lr;
+    lossyReader_t reader;
+    uint64_t maxNum;
+    _Atomic int done;
+} threadArg_t;
+
+void *readHandler(void *arg)
+{
+    threadArg_t *t = arg;
+    uint64_t sample, received = 0;
+    volatile uint32_t work;
+
+    while(!atomic_load(&t->done) || t->reader.pos < atomic_load(&t->lr->headIdx)) {
+        if(lossyReadFromBuffer(t->lr, &t->reader, &sample) == ACCESS_FAIL) {
+            sched_yield();
+            continue;
+        }
+
+        // the writer stores its position as the sample value
+        if(sample != t->reader.pos - 1) {
+            printf("ERROR: read sample %llu at position %llu\n",
+                    (unsigned long long)sample, (unsigned long long)(t->reader.pos - 1));
+            exit(EXIT_FAILURE);
+        }
+        received++;
+
+        for(work = 0; work < DEMO_WORK_LOOPS; work++);
+    }
+
+    if(received + t->reader.missed != t->maxNum) {
+        printf("ERROR: received %llu + missed %llu != written %llu\n", (unsigned long long)received,
+                (unsigned long long)t->reader.missed, (unsigned long long)t->maxNum);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Received %llu samples, missed %llu\n",
+            (unsigned long long)received, (unsigned long long)t->reader.missed);
+    pthread_exit(NULL);
+}
+
+void *writeHandler(void *arg)
+{
+    threadArg_t *t = arg;
+    uint64_t sample;
+
+    // never waits, however slow the reader is
+    for(sample = 0; sample < t->maxNum; sample++) {
+        lossyWriteToBuffer(t->lr, &sample);
+    }
+
+    atomic_store(&t->done, 1);
+    pthread_exit(NULL);
+}
+
+void handle_sigint(int sig)
+{
+    printf("Caught signal %d\n", sig);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char **argv) {
+    int ret;
+    lossyRing_t lr;
+    threadArg_t arg;
+    pthread_t threads[MAX_NUM_OF_THREADS];
+
+    if(argc < 2) {
+        printf("Usage: %s <count>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(lossyRingInit(&lr, sizeof(uint64_t), DEMO_RING_SIZE)) {
+        printf("ERROR: lossy ring init failure\n");
+        exit(EXIT_FAILURE);
+    }
+    arg.lr = &lr;
+    arg.maxNum = strtoull(argv[1], NULL, 10);
+    atomic_init(&arg.done, 0);
+    lossyReaderInit(&lr, &arg.reader);
+
+    signal(SIGINT, handle_sigint);
+
+    ret = pthread_create(&threads[READ_THREAD_IDX], NULL, readHandler, &arg);
+    if(ret) {
+        printf("ERROR: Reading thread creation failure\n");
+        exit(EXIT_FAILURE);
+    } else {
+        printf("reading thread created\n");
+    }
+
+    ret = pthread_create(&threads[WRITE_THREAD_IDX], NULL, writeHandler, &arg);
+    if(ret) {
+        printf("ERROR: Writing thread creation failure\n");
+        exit(EXIT_FAILURE);
+    } else {
+        printf("writing thread created\n");
+    }
+
+    pthread_join(threads[READ_THREAD_IDX], NULL);
+    pthread_join(threads[WRITE_THREAD_IDX], NULL);
+
+    lossyRingFree(&lr);
+
+    return 0;
+}
+#endif
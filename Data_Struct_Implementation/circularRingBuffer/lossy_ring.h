@@ -0,0 +1,50 @@
+#pragma once
+
+#include "ring_buffer.h"
+
+/*
+Slot of the overwrite-oldest ring. seq is a per-slot seqlock holding
+the position it was last written for:
+  2 * pos + 1   the writer is filling the slot for position pos
+  2 * pos + 2   the slot holds the element of position pos
+The payload is copied as relaxed atomic words so a reader racing the
+writer gets a torn copy, never undefined behaviour, and rejects it by
+re-checking seq.
+*/
+typedef struct {
+    _Atomic uint64_t seq;
+    _Atomic uint64_t data[];
+} lossySlot_t;
+
+/*
+Single-writer ring for telemetry that prefers losing old samples to
+blocking: the writer never waits for readers and simply overwrites the
+oldest slot. Readers are independent, each keeps its own position and
+counts what it missed.
+*/
+typedef struct {
+    // writer side
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t headIdx;
+
+    // read-only after lossyRingInit()
+    _Alignas(CACHE_LINE_SIZE) uint32_t mask;
+    uint32_t elemSize;
+    uint32_t slotSize;
+    uint8_t *slots;
+} lossyRing_t;
+
+typedef struct {
+    uint64_t pos;       // next position to read
+    uint64_t missed;    // samples overwritten before we got to them
+} lossyReader_t;
+
+int lossyRingInit(lossyRing_t *lr, uint32_t elemSize, uint32_t capacity);
+void lossyRingFree(lossyRing_t *lr);
+
+/* Writer: never blocks, overwrites the oldest element when full */
+void lossyWriteToBuffer(lossyRing_t *lr, const void *data);
+
+/* Reader: start at the writer's current position */
+void lossyReaderInit(lossyRing_t *lr, lossyReader_t *reader);
+/* ACCESS_FAIL when nothing new; skipped samples are added to reader->missed */
+uint32_t lossyReadFromBuffer(lossyRing_t *lr, lossyReader_t *reader, void *data);
@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sched.h>
+
+#include "multicast_ring.h"
+
+int multicastRingInit(multicastRing_t *mr, uint32_t elemSize, uint32_t capacity) {
+    if(capacity == 0 || (capacity & (capacity - 1)) || elemSize == 0) {
+        return -1;
+    }
+
+    mr->buffer = aligned_alloc(CACHE_LINE_SIZE,
+            ((size_t)elemSize * capacity + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1));
+    if(mr->buffer == NULL) {
+        return -1;
+    }
+
+    mr->mask = capacity - 1;
+    mr->elemSize = elemSize;
+    mr->numConsumers = 0;
+    atomic_init(&mr->publishedIdx, 0);
+    mr->cachedMinCursor = 0;
+
+    return 0;
+}
+
+void multicastRingFree(multicastRing_t *mr) {
+    free(mr->buffer);
+    mr->buffer = NULL;
+}
+
+int multicastRingAddConsumer(multicastRing_t *mr, int upstream) {
+    multicastConsumer_t *c;
+
+    // a stage can only depend on the producer or on an earlier stage
+    if(mr->numConsumers == MULTICAST_MAX_CONSUMERS ||
+       upstream < MULTICAST_PRODUCER || upstream >= (int)mr->numConsumers) {
+        return -1;
+    }
+
+    c = &mr->consumers[mr->numConsumers];
+    atomic_init(&c->cursor, atomic_load(&mr->publishedIdx));
+    c->cachedUpstream = atomic_load(&c->cursor);
+    if(upstream == MULTICAST_PRODUCER) {
+        c->upstream = &mr->publishedIdx;
+    } else {
+        c->upstream = &mr->consumers[upstream].cursor;
+    }
+
+    return mr->numConsumers++;
+}
+
+/* Producer side only: oldest cursor, i.e. the one lagging furthest behind head */
+static uint32_t minCursor(multicastRing_t *mr, uint32_t head) {
+    uint32_t i, lag, maxLag = 0;
+
+    for(i = 0; i < mr->numConsumers; i++) {
+        lag = head - atomic_load_explicit(&mr->consumers[i].cursor, memory_order_acquire);
+        if(lag > maxLag) {
+            maxLag = lag;
+        }
+    }
+
+    return head - maxLag;
+}
+
+/* Producer side only */
+void *multicastRingClaim(multicastRing_t *mr) {
+    uint32_t head = atomic_load_explicit(&mr->publishedIdx, memory_order_relaxed);
+
+    // only scan the consumer cursors when the cached minimum says full
+    if(head - mr->cachedMinCursor > mr->mask) {
+        mr->cachedMinCursor = minCursor(mr, head);
+        if(head - mr->cachedMinCursor > mr->mask) {
+            return NULL;
+        }
+    }
+
+    return mr->buffer + (size_t)(head & mr->mask) * mr->elemSize;
+}
+
+/* Producer side only */
+void multicastRingPublish(multicastRing_t *mr) {
+    uint32_t head = atomic_load_explicit(&mr->publishedIdx, memory_order_relaxed);
+
+    atomic_store_explicit(&mr->publishedIdx, head + 1, memory_order_release);
+}
+
+uint32_t multicastWriteToBuffer(multicastRing_t *mr, const void *data) {
+    void *slot = multicastRingClaim(mr);
+
+    if(slot == NULL) {
+        return ACCESS_FAIL;
+    }
+
+    memcpy(slot, data, mr->elemSize);
+    multicastRingPublish(mr);
+
+    return ACCESS_SUCCESS;
+}
+
+/* Consumer id only */
+uint32_t multicastRingAvailable(multicastRing_t *mr, int id) {
+    multicastConsumer_t *c = &mr->consumers[id];
+    uint32_t cursor = atomic_load_explicit(&c->cursor, memory_order_relaxed);
+
+    if(c->cachedUpstream == cursor) {
+        c->cachedUpstream = atomic_load_explicit(c->upstream, memory_order_acquire);
+    }
+
+    return c->cachedUpstream - cursor;
+}
+
+void *multicastRingEntry(multicastRing_t *mr, int id, uint32_t i) {
+    uint32_t cursor = atomic_load_explicit(&mr->consumers[id].cursor, memory_order_relaxed);
+
+    return mr->buffer + (size_t)((cursor + i) & mr->mask) * mr->elemSize;
+}
+
+void multicastRingConsume(multicastRing_t *mr, int id, uint32_t n) {
+    multicastConsumer_t *c = &mr->consumers[id];
+    uint32_t cursor = atomic_load_explicit(&c->cursor, memory_order_relaxed);
+
+    // release: downstream stages and the producer see our work on the entries
+    atomic_store_explicit(&c->cursor, cursor + n, memory_order_release);
+}
+
+uint32_t multicastReadFromBuffer(multicastRing_t *mr, int id, void *data) {
+    if(multicastRingAvailable(mr, id) == 0) {
+        return ACCESS_FAIL;
+    }
+
+    memcpy(data, multicastRingEntry(mr, id, 0), mr->elemSize);
+    multicastRingConsume(mr, id, 1);
+
+    return ACCESS_SUCCESS;
+}
+
+/* Demo, left out when the queue is linked into ring_bench */
+#ifndef RING_BUFFER_NO_MAIN
+#define DEMO_SPIN_LIMIT     128
+
+/* control fills in 'command', recording is chained after control and checks it */
+typedef struct {
+    uint32_t sample;
+    uint32_t command;
+} sensorEntry_t;
+
+typedef struct {
+    multicastRing_t *mr;
+    int id;
+    const char *name;
+    uint32_t maxNum;
+} threadArg_t;
+
+static void backoff(uint32_t *spins) {
+    if(++*spins < DEMO_SPIN_LIMIT) {
+        cpuRelax();
+    } else {
+        sched_yield();
+    }
+}
+
+void *controlHandler(void *arg)
+{
+    threadArg_t *t = arg;
+    uint32_t seen = 0, i, n, spins = 0;
+    sensorEntry_t *e;
+
+    while(seen < t->maxNum) {
+        n = multicastRingAvailable(t->mr, t->id);
+        if(n == 0) {
+            backoff(&spins);
+            continue;
+        }
+        spins = 0;
+
+        // work on the whole batch in place, then publish once
+        for(i = 0; i < n; i++) {
+            e = multicastRingEntry(t->mr, t->id, i);
+            e->command = e->sample * 2;
+        }
+        multicastRingConsume(t->mr, t->id, n);
+        seen += n;
+    }
+
+    printf("%s: processed %u entries\n", t->name, seen);
+    pthread_exit(NULL);
+}
+
+/* logging (after the producer) and recording (after control) */
+void *checkHandler(void *arg)
+{
+    threadArg_t *t = arg;
+    uint32_t seen = 0, i, n, spins = 0;
+    sensorEntry_t *e;
+
+    while(seen < t->maxNum) {
+        n = multicastRingAvailable(t->mr, t->id);
+        if(n == 0) {
+            backoff(&spins);
+            continue;
+        }
+        spins = 0;
+
+        for(i = 0; i < n; i++) {
+            e = multicastRingEntry(t->mr, t->id, i);
+            if(e->sample != seen + i + 1) {
+                printf("ERROR: %s read sample %u, expected %u\n", t->name, e->sample, seen + i + 1);
+                exit(EXIT_FAILURE);
+            }
+            if(!strcmp(t->name, "recording") && e->command != e->sample * 2) {
+                printf("ERROR: recording saw sample %u before control finished it\n", e->sample);
+                exit(EXIT_FAILURE);
+            }
+        }
+        multicastRingConsume(t->mr, t->id, n);
+        seen += n;
+    }
+
+    printf("%s: checked %u entries in order\n", t->name, seen);
+    pthread_exit(NULL);
+}
+
+void *writeHandler(void *arg)
+{
+    threadArg_t *t = arg;
+    uint32_t counter = 1, spins = 0;
+    sensorEntry_t *e;
+
+    while(counter <= t->maxNum) {
+        e = multicastRingClaim(t->mr);
+        if(e == NULL) {
+            backoff(&spins);
+            continue;
+        }
+        spins = 0;
+
+        e->sample = counter++;
+        e->command = 0;
+        multicastRingPublish(t->mr);
+    }
+
+    pthread_exit(NULL);
+}
+
+void handle_sigint(int sig)
+{
+    printf("Caught signal %d\n", sig);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char **argv) {
+    multicastRing_t mr;
+    threadArg_t args[4];
+    pthread_t threads[4];
+    uint32_t maxNum;
+    int i;
+
+    if(argc < 2) {
+        printf("Usage: %s <count>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    maxNum = atoi(argv[1]);
+
+    if(multicastRingInit(&mr, sizeof(sensorEntry_t), RING_BUFFER_SIZE)) {
+        printf("ERROR: multicast ring init failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // control and logging follow the producer, recording follows control
+    args[0] = (threadArg_t){ &mr, multicastRingAddConsumer(&mr, MULTICAST_PRODUCER), "control", maxNum };
+    args[1] = (threadArg_t){ &mr, multicastRingAddConsumer(&mr, MULTICAST_PRODUCER), "logging", maxNum };
+    args[2] = (threadArg_t){ &mr, multicastRingAddConsumer(&mr, args[0].id), "recording", maxNum };
+    args[3] = (threadArg_t){ &mr, -1, "producer", maxNum };
+
+    signal(SIGINT, handle_sigint);
+
+    if(pthread_create(&threads[0], NULL, controlHandler, &args[0]) ||
+       pthread_create(&threads[1], NULL, checkHandler, &args[1]) ||
+       pthread_create(&threads[2], NULL, checkHandler, &args[2]) ||
+       pthread_create(&threads[3], NULL, writeHandler, &args[3])) {
+        printf("ERROR: thread creation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    multicastRingFree(&mr);
+
+    return 0;
+}
+#endif
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "ring_buffer.h"
+
+#define MULTICAST_MAX_CONSUMERS     8
+#define MULTICAST_PRODUCER          (-1) // upstream of a first-stage consumer
+
+/*
+Each consumer owns a cursor (how many entries it has finished) on its
+own cache line and follows an upstream cursor: the producer's published
+index for a first stage, or another consumer's cursor for a chained
+stage. A chained stage therefore only sees entries its upstream stage
+has finished.
+*/
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t cursor;
+    uint32_t cachedUpstream;
+    _Atomic uint32_t *upstream;
+} multicastConsumer_t;
+
+/*
+Single-producer ring read by several independent consumers, Disruptor
+style: every consumer sees every entry, in place, without a copy per
+stage. The producer may only overwrite a slot once all consumers are
+done with it, so its wrap check uses the minimum consumer cursor,
+cached and recomputed only when the cached value says the ring is full.
+*/
+typedef struct {
+    // producer side
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t publishedIdx;
+    uint32_t cachedMinCursor;
+
+    multicastConsumer_t consumers[MULTICAST_MAX_CONSUMERS];
+
+    // read-only once the producer starts
+    _Alignas(CACHE_LINE_SIZE) uint32_t numConsumers;
+    uint32_t mask;
+    uint32_t elemSize;
+    uint8_t *buffer;
+} multicastRing_t;
+
+int multicastRingInit(multicastRing_t *mr, uint32_t elemSize, uint32_t capacity);
+void multicastRingFree(multicastRing_t *mr);
+/* Register a consumer before the producer starts, returns its id or -1 */
+int multicastRingAddConsumer(multicastRing_t *mr, int upstream);
+
+/* Producer: slot to fill in place (NULL when full), then publish it */
+void *multicastRingClaim(multicastRing_t *mr);
+void multicastRingPublish(multicastRing_t *mr);
+uint32_t multicastWriteToBuffer(multicastRing_t *mr, const void *data);
+
+/* Consumer: entries ready for this consumer, access them in place, then mark n done */
+uint32_t multicastRingAvailable(multicastRing_t *mr, int id);
+void *multicastRingEntry(multicastRing_t *mr, int id, uint32_t i);
+void multicastRingConsume(multicastRing_t *mr, int id, uint32_t n);
+uint32_t multicastReadFromBuffer(multicastRing_t *mr, int id, void *data);
@@ -0,0 +1,588 @@
+/*
+Throughput/latency benchmark for the queues in this directory.
+
+Every element carries the clock value taken by the producer right
+before it was enqueued in its first 8 bytes; the consumer subtracts it
+from its own clock after dequeuing, so the latency is the hand-off
+time between the two cores, not the time spent in printf. On x86 the
+clock is the TSC (needs an invariant TSC to compare it across cores,
+see constant_tsc/nonstop_tsc in /proc/cpuinfo), elsewhere it falls back
+to CLOCK_MONOTONIC.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "ring_buffer.h"
+#include "buffer_multithread.h"
+#include "byte_ring.h"
+#include "multicast_ring.h"
+#include "lossy_ring.h"
+
+#define BENCH_MAX_THREADS   64
+#define BENCH_MAX_SAMPLES   (1 << 20) // latency samples kept per consumer
+#define BENCH_MAX_BATCH     1024
+#define BENCH_SPIN_LIMIT    128
+
+typedef enum {
+    BENCH_SPSC = 0,     // ring_buffer.c
+    BENCH_MPMC,         // buffer_multithread.c
+    BENCH_BYTE,         // byte_ring.c
+    BENCH_MULTICAST,    // multicast_ring.c, every consumer sees every element
+    BENCH_LOSSY         // lossy_ring.c, producer never waits, consumers may miss elements
+} benchQueue_t;
+
+typedef struct {
+    benchQueue_t queue;
+    uint32_t elemSize;
+    uint32_t batch;
+    uint32_t capacity;
+    uint32_t producers;
+    uint32_t consumers;
+    uint64_t count;             // elements per producer
+    ringWaitPolicy_t wait;
+    int producerCpus[BENCH_MAX_THREADS];
+    int consumerCpus[BENCH_MAX_THREADS];
+    uint32_t numProducerCpus;
+    uint32_t numConsumerCpus;
+} benchConfig_t;
+
+typedef struct {
+    pthread_t thread;
+    uint32_t id;
+    int cpu;
+    uint64_t *samples;
+    uint32_t numSamples;
+    lossyReader_t reader;
+} benchThread_t;
+
+static const char *queueNames[] = { "spsc", "mpmc", "byte", "multicast", "lossy" };
+static const char *waitNames[] = { "spin", "yield", "park" };
+
+static benchConfig_t cfg = {
+    .queue = BENCH_SPSC,
+    .elemSize = 16,
+    .batch = 1,
+    .capacity = 1024,
+    .producers = 1,
+    .consumers = 1,
+    .count = 1000000,
+    .wait = RING_WAIT_SPIN,
+};
+
+static ringBuffer_t spsc;
+static mpmcQueue_t mpmc;
+static byteRing_t byteRing;
+static multicastRing_t multicast;
+static lossyRing_t lossy;
+
+static pthread_barrier_t startBarrier;
+static _Atomic uint64_t consumed;   // only for several MPMC consumers, see consumerThread()
+static uint64_t total;
+static uint32_t sampleEvery;
+static double ticksPerNs = 1.0;
+
+static inline uint64_t readClock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Clock ticks per nanosecond, measured against CLOCK_MONOTONIC */
+static void calibrateClock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec delay = { 0, 50 * 1000 * 1000 };
+    uint64_t ns = nowNs(), ticks = readClock();
+
+    nanosleep(&delay, NULL);
+    ticksPerNs = (double)(readClock() - ticks) / (double)(nowNs() - ns);
+#endif
+}
+
+static void pinThread(int cpu) {
+    cpu_set_t set;
+
+    if(cpu < 0) {
+        return;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+        printf("WARNING: cannot pin thread to cpu %d\n", cpu);
+    }
+}
+
+static void backoff(uint32_t *spins) {
+    if(cfg.wait == RING_WAIT_SPIN || ++*spins < BENCH_SPIN_LIMIT) {
+        cpuRelax();
+    } else {
+        sched_yield();
+    }
+}
+
+static void *producerThread(void *arg) {
+    benchThread_t *t = arg;
+    uint8_t *buffer = calloc(cfg.batch, cfg.elemSize);
+    uint64_t sent = 0, stamp;
+    uint32_t i, n, want, spins = 0;
+    void *msg;
+
+    pinThread(t->cpu);
+    pthread_barrier_wait(&startBarrier);
+
+    while(sent < cfg.count) {
+        want = cfg.count - sent < cfg.batch ? (uint32_t)(cfg.count - sent) : cfg.batch;
+
+        // stamp on every attempt so back-pressure waits are not counted
+        stamp = readClock();
+        for(i = 0; i < want; i++) {
+            memcpy(buffer + (size_t)i * cfg.elemSize, &stamp, sizeof(stamp));
+        }
+
+        switch(cfg.queue) {
+        case BENCH_SPSC:
+            n = want > 1 ? writeBatch(&spsc, buffer, want) : writeToBuffer(&spsc, buffer) == ACCESS_SUCCESS;
+            break;
+        case BENCH_MPMC:
+            n = mpmcTryWriteToBuffer(&mpmc, buffer) == ACCESS_SUCCESS;
+            break;
+        case BENCH_MULTICAST:
+            n = multicastWriteToBuffer(&multicast, buffer) == ACCESS_SUCCESS;
+            break;
+        case BENCH_LOSSY:
+            lossyWriteToBuffer(&lossy, buffer);
+            n = 1;
+            break;
+        default:
+            msg = byteRingReserve(&byteRing, cfg.elemSize);
+            n = msg != NULL;
+            if(n) {
+                memcpy(msg, buffer, cfg.elemSize);
+                byteRingCommit(&byteRing, cfg.elemSize);
+            }
+            break;
+        }
+
+        if(n == 0) {
+            if(cfg.queue == BENCH_SPSC) {
+                ringBufferWaitForSpace(&spsc, &spins);
+            } else {
+                backoff(&spins);
+            }
+            continue;
+        }
+
+        spins = 0;
+        sent += n;
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+static void *consumerThread(void *arg) {
+    benchThread_t *t = arg;
+    uint8_t *buffer = calloc(cfg.batch, cfg.elemSize);
+    uint64_t seen = 0, published = 0, now, stamp;
+    uint32_t i, n, len, spins = 0;
+    // MPMC consumers share the elements, none knows alone when they are all taken
+    int shared = cfg.queue == BENCH_MPMC && cfg.consumers > 1;
+    void *msg;
+
+    pinThread(t->cpu);
+    pthread_barrier_wait(&startBarrier);
+
+    // a lone consumer, and every multicast/lossy one, sees all elements
+    while(cfg.queue == BENCH_LOSSY ? t->reader.pos < total : shared || seen < total) {
+        switch(cfg.queue) {
+        case BENCH_SPSC:
+            n = cfg.batch > 1 ? readBatch(&spsc, buffer, cfg.batch) : readFromBuffer(&spsc, buffer) == ACCESS_SUCCESS;
+            break;
+        case BENCH_MPMC:
+            n = mpmcTryReadFromBuffer(&mpmc, buffer) == ACCESS_SUCCESS;
+            break;
+        case BENCH_MULTICAST:
+            n = multicastRingAvailable(&multicast, t->id);
+            if(n > cfg.batch) {
+                n = cfg.batch;
+            }
+            for(i = 0; i < n; i++) {
+                memcpy(buffer + (size_t)i * cfg.elemSize, multicastRingEntry(&multicast, t->id, i), cfg.elemSize);
+            }
+            multicastRingConsume(&multicast, t->id, n);
+            break;
+        case BENCH_LOSSY:
+            n = lossyReadFromBuffer(&lossy, &t->reader, buffer) == ACCESS_SUCCESS;
+            break;
+        default:
+            msg = byteRingPeek(&byteRing, &len);
+            n = msg != NULL;
+            if(n) {
+                memcpy(buffer, msg, len);
+                byteRingRelease(&byteRing);
+            }
+            break;
+        }
+
+        if(n == 0) {
+            // publish the local count only when the queue looks empty, off the hand-off path
+            if(shared) {
+                if(seen != published) {
+                    atomic_fetch_add_explicit(&consumed, seen - published, memory_order_relaxed);
+                    published = seen;
+                }
+                if(atomic_load_explicit(&consumed, memory_order_relaxed) >= total) {
+                    break;
+                }
+            }
+
+            if(cfg.queue == BENCH_SPSC) {
+                ringBufferWaitForData(&spsc, &spins);
+            } else {
+                backoff(&spins);
+            }
+            continue;
+        }
+
+        spins = 0;
+        now = readClock();
+        for(i = 0; i < n; i++) {
+            if(++seen % sampleEvery == 0 && t->numSamples < BENCH_MAX_SAMPLES) {
+                memcpy(&stamp, buffer + (size_t)i * cfg.elemSize, sizeof(stamp));
+                t->samples[t->numSamples++] = now - stamp;
+            }
+        }
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+/* Integer from /sys/devices/system/cpu/cpuN/topology/<attr>, -1 if missing */
+static int readCpuTopology(int cpu, const char *attr) {
+    char path[128];
+    FILE *f;
+    int val = -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, attr);
+    f = fopen(path, "r");
+    if(f) {
+        if(fscanf(f, "%d", &val) != 1) {
+            val = -1;
+        }
+        fclose(f);
+    }
+
+    return val;
+}
+
+/*
+Pick a producer/consumer cpu pair for a named layout:
+  same   both threads on one logical cpu
+  smt    SMT siblings, same physical core
+  core   different physical cores, same socket
+  cross  different sockets
+*/
+static int pickLayout(const char *layout, int *producerCpu, int *consumerCpu) {
+    cpu_set_t allowed;
+    int cpu, base = -1;
+    int sameCore, samePackage;
+
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for(cpu = 0; cpu < CPU_SETSIZE && base < 0; cpu++) {
+        if(CPU_ISSET(cpu, &allowed)) {
+            base = cpu;
+        }
+    }
+
+    *producerCpu = base;
+    if(!strcmp(layout, "same")) {
+        *consumerCpu = base;
+        return 0;
+    }
+
+    for(cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if(cpu == base || !CPU_ISSET(cpu, &allowed)) {
+            continue;
+        }
+
+        samePackage = readCpuTopology(cpu, "physical_package_id") == readCpuTopology(base, "physical_package_id");
+        sameCore = samePackage && readCpuTopology(cpu, "core_id") == readCpuTopology(base, "core_id");
+
+        if((!strcmp(layout, "smt") && sameCore) ||
+           (!strcmp(layout, "core") && samePackage && !sameCore) ||
+           (!strcmp(layout, "cross") && !samePackage)) {
+            *consumerCpu = cpu;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static uint32_t parseCpuList(const char *list, int *cpus) {
+    uint32_t n = 0;
+    char *end;
+
+    while(*list && n < BENCH_MAX_THREADS) {
+        cpus[n++] = strtol(list, &end, 10);
+        list = *end == ',' ? end + 1 : end;
+        if(end == list) {
+            break;
+        }
+    }
+
+    return n;
+}
+
+static int compareU64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentileNs(uint64_t *sorted, uint64_t n, double p) {
+    uint64_t idx = (uint64_t)(p * (double)(n - 1));
+    return (double)sorted[idx] / ticksPerNs;
+}
+
+/* Index of name in names, -1 if it is not there */
+static int lookupName(const char *const *names, int count, const char *name) {
+    int i;
+
+    for(i = 0; i < count; i++) {
+        if(!strcmp(names[i], name)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options]\n"
+           "  -q spsc|mpmc|byte|multicast|lossy  queue under test (default spsc)\n"
+           "  -e bytes            element size, >= 8 (default 16)\n"
+           "  -b n                batch size, spsc and multicast consumers (default 1)\n"
+           "  -s n                capacity in elements, power of two (default 1024)\n"
+           "  -n n                elements per producer (default 1000000)\n"
+           "  -p n / -c n         producers / consumers, mpmc only; multicast/lossy take -c (default 1/1)\n"
+           "  -w spin|yield|park  wait policy (park is spsc only)\n"
+           "  -L same|smt|core|cross  pin the producer/consumer pair by topology\n"
+           "  -P cpus / -C cpus   explicit comma separated cpu lists, round-robin\n", prog);
+}
+
+int main(int argc, char **argv) {
+    benchThread_t producers[BENCH_MAX_THREADS], consumers[BENCH_MAX_THREADS];
+    const char *layout = NULL;
+    uint64_t *all, numAll = 0, start, elapsed;
+    uint32_t i;
+    int opt, ret;
+
+    while((opt = getopt(argc, argv, "q:e:b:s:n:p:c:w:L:P:C:h")) != -1) {
+        switch(opt) {
+        case 'q':
+            ret = lookupName(queueNames, sizeof(queueNames) / sizeof(queueNames[0]), optarg);
+            if(ret < 0) {
+                printf("ERROR: unknown queue '%s'\n", optarg);
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            cfg.queue = ret;
+            break;
+        case 'e': cfg.elemSize = atoi(optarg); break;
+        case 'b': cfg.batch = atoi(optarg); break;
+        case 's': cfg.capacity = atoi(optarg); break;
+        case 'n': cfg.count = strtoull(optarg, NULL, 10); break;
+        case 'p': cfg.producers = atoi(optarg); break;
+        case 'c': cfg.consumers = atoi(optarg); break;
+        case 'w':
+            ret = lookupName(waitNames, sizeof(waitNames) / sizeof(waitNames[0]), optarg);
+            if(ret < 0) {
+                printf("ERROR: unknown wait policy '%s'\n", optarg);
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            cfg.wait = ret;
+            break;
+        case 'L': layout = optarg; break;
+        case 'P': cfg.numProducerCpus = parseCpuList(optarg, cfg.producerCpus); break;
+        case 'C': cfg.numConsumerCpus = parseCpuList(optarg, cfg.consumerCpus); break;
+        default:
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(cfg.elemSize < sizeof(uint64_t) || cfg.batch < 1 || cfg.batch > BENCH_MAX_BATCH ||
+       cfg.producers < 1 || cfg.producers > BENCH_MAX_THREADS ||
+       cfg.consumers < 1 || cfg.consumers > BENCH_MAX_THREADS || cfg.count == 0) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(cfg.queue != BENCH_MPMC && cfg.producers != 1) {
+        printf("ERROR: %s is single-producer\n", queueNames[cfg.queue]);
+        exit(EXIT_FAILURE);
+    }
+    if((cfg.queue == BENCH_SPSC || cfg.queue == BENCH_BYTE) && cfg.consumers != 1) {
+        printf("ERROR: %s is single-consumer\n", queueNames[cfg.queue]);
+        exit(EXIT_FAILURE);
+    }
+    if(cfg.queue == BENCH_MULTICAST && cfg.consumers > MULTICAST_MAX_CONSUMERS) {
+        printf("ERROR: multicast supports up to %d consumers\n", MULTICAST_MAX_CONSUMERS);
+        exit(EXIT_FAILURE);
+    }
+    // refuse rather than report numbers for a configuration nobody asked for
+    if(cfg.queue != BENCH_SPSC && cfg.queue != BENCH_MULTICAST && cfg.batch != 1) {
+        printf("ERROR: %s has no batch interface, -b is spsc/multicast only\n", queueNames[cfg.queue]);
+        exit(EXIT_FAILURE);
+    }
+    if(cfg.queue != BENCH_SPSC && cfg.wait == RING_WAIT_PARK) {
+        printf("ERROR: %s cannot park, -w park is spsc only\n", queueNames[cfg.queue]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(layout) {
+        int p, c;
+        if(pickLayout(layout, &p, &c)) {
+            printf("ERROR: no cpu pair matches layout '%s' on this machine\n", layout);
+            exit(EXIT_FAILURE);
+        }
+        cfg.producerCpus[0] = p;
+        cfg.consumerCpus[0] = c;
+        cfg.numProducerCpus = cfg.numConsumerCpus = 1;
+    }
+
+    switch(cfg.queue) {
+    case BENCH_SPSC:
+        ret = ringBufferInit(&spsc, cfg.elemSize, cfg.capacity);
+        ringBufferSetWaitPolicy(&spsc, cfg.wait);
+        break;
+    case BENCH_MPMC:
+        ret = mpmcQueueInit(&mpmc, cfg.elemSize, cfg.capacity);
+        break;
+    case BENCH_LOSSY:
+        ret = lossyRingInit(&lossy, cfg.elemSize, cfg.capacity);
+        break;
+    case BENCH_MULTICAST:
+        ret = multicastRingInit(&multicast, cfg.elemSize, cfg.capacity);
+        for(i = 0; i < cfg.consumers && !ret; i++) {
+            ret = multicastRingAddConsumer(&multicast, MULTICAST_PRODUCER) < 0;
+        }
+        break;
+    default: {
+        // capacity is in elements, size the byte ring to hold at least as many records
+        // and at least two, a record may not take more than half the ring
+        uint32_t bytes = 1, need = (cfg.capacity < 2 ? 2 : cfg.capacity) *
+                ((cfg.elemSize + sizeof(byteRecord_t) + BYTE_RING_ALIGN - 1) & ~(BYTE_RING_ALIGN - 1));
+        while(bytes < need) {
+            bytes <<= 1;
+        }
+        ret = byteRingInit(&byteRing, bytes);
+        if(!ret && cfg.elemSize > byteRingMaxRecord(&byteRing)) {
+            printf("ERROR: %u byte records do not fit a byte ring\n", cfg.elemSize);
+            exit(EXIT_FAILURE);
+        }
+        break;
+    }
+    }
+    if(ret) {
+        printf("ERROR: queue init failure (capacity must be a power of two)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    calibrateClock();
+    total = cfg.count * cfg.producers;
+    sampleEvery = (cfg.queue == BENCH_MULTICAST || cfg.queue == BENCH_LOSSY ? total : total / cfg.consumers) / BENCH_MAX_SAMPLES + 1;
+    atomic_init(&consumed, 0);
+    pthread_barrier_init(&startBarrier, NULL, cfg.producers + cfg.consumers + 1);
+
+    for(i = 0; i < cfg.consumers; i++) {
+        consumers[i] = (benchThread_t){ .id = i, .cpu = -1 };
+        if(cfg.numConsumerCpus) {
+            consumers[i].cpu = cfg.consumerCpus[i % cfg.numConsumerCpus];
+        }
+        consumers[i].samples = malloc(sizeof(uint64_t) * BENCH_MAX_SAMPLES);
+        if(cfg.queue == BENCH_LOSSY) {
+            lossyReaderInit(&lossy, &consumers[i].reader);
+        }
+        pthread_create(&consumers[i].thread, NULL, consumerThread, &consumers[i]);
+    }
+    for(i = 0; i < cfg.producers; i++) {
+        producers[i] = (benchThread_t){ .id = i, .cpu = -1 };
+        if(cfg.numProducerCpus) {
+            producers[i].cpu = cfg.producerCpus[i % cfg.numProducerCpus];
+        }
+        pthread_create(&producers[i].thread, NULL, producerThread, &producers[i]);
+    }
+
+    pthread_barrier_wait(&startBarrier);
+    start = nowNs();
+
+    for(i = 0; i < cfg.producers; i++) {
+        pthread_join(producers[i].thread, NULL);
+    }
+    for(i = 0; i < cfg.consumers; i++) {
+        pthread_join(consumers[i].thread, NULL);
+    }
+    elapsed = nowNs() - start;
+
+    all = malloc(sizeof(uint64_t) * BENCH_MAX_SAMPLES * cfg.consumers);
+    for(i = 0; i < cfg.consumers; i++) {
+        memcpy(all + numAll, consumers[i].samples, sizeof(uint64_t) * consumers[i].numSamples);
+        numAll += consumers[i].numSamples;
+        free(consumers[i].samples);
+    }
+    qsort(all, numAll, sizeof(uint64_t), compareU64);
+
+    printf("queue=%s elem=%uB batch=%u capacity=%u producers=%u consumers=%u wait=%s",
+            queueNames[cfg.queue], cfg.elemSize, cfg.batch, cfg.capacity,
+            cfg.producers, cfg.consumers, waitNames[cfg.wait]);
+    if(cfg.numProducerCpus && cfg.numConsumerCpus) {
+        printf(" cpus=%d->%d", cfg.producerCpus[0], cfg.consumerCpus[0]);
+    }
+    printf("\n");
+    printf("  throughput: %.2f Mops/s (%llu ops in %.3f s)\n",
+            (double)total * 1e3 / (double)elapsed, (unsigned long long)total, (double)elapsed / 1e9);
+    if(numAll) {
+        printf("  latency ns: p50 %.0f  p99 %.0f  p999 %.0f  (%llu samples)\n",
+                percentileNs(all, numAll, 0.50), percentileNs(all, numAll, 0.99),
+                percentileNs(all, numAll, 0.999), (unsigned long long)numAll);
+    }
+    for(i = 0; cfg.queue == BENCH_LOSSY && i < cfg.consumers; i++) {
+        printf("  consumer %u missed %llu elements\n", i, (unsigned long long)consumers[i].reader.missed);
+    }
+
+    free(all);
+    pthread_barrier_destroy(&startBarrier);
+    switch(cfg.queue) {
+    case BENCH_SPSC: ringBufferFree(&spsc); break;
+    case BENCH_MPMC: mpmcQueueFree(&mpmc); break;
+    case BENCH_MULTICAST: multicastRingFree(&multicast); break;
+    case BENCH_LOSSY: lossyRingFree(&lossy); break;
+    default: byteRingFree(&byteRing); break;
+    }
+
+    return 0;
+}
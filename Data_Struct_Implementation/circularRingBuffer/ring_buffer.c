@@ -1,88 +1,365 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
-#include<signal.h> 
+#include <signal.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "ring_buffer.h"
 
-static uint32_t ringBuffer[RING_BUFFER_SIZE];
-static uint32_t headIdx;
-static uint32_t tailIdx;
+int ringBufferInit(ringBuffer_t *rb, uint32_t elemSize, uint32_t capacity) {
+    // mask indexing only works for power-of-two capacities
+    if(capacity == 0 || (capacity & (capacity - 1)) || elemSize == 0) {
+        return -1;
+    }
+
+    rb->buffer = aligned_alloc(CACHE_LINE_SIZE,
+            ((size_t)elemSize * capacity + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1));
+    if(rb->buffer == NULL) {
+        return -1;
+    }
+
+    rb->mask = capacity - 1;
+    rb->elemSize = elemSize;
+    atomic_init(&rb->headIdx, 0);
+    atomic_init(&rb->tailIdx, 0);
+    rb->cachedHeadIdx = 0;
+    rb->cachedTailIdx = 0;
+    atomic_init(&rb->consumerWaiting, 0);
+    atomic_init(&rb->producerWaiting, 0);
+    rb->waitPolicy = RING_WAIT_SPIN;
+
+    return 0;
+}
+
+void ringBufferSetWaitPolicy(ringBuffer_t *rb, ringWaitPolicy_t policy) {
+    rb->waitPolicy = policy;
+}
+
+static void futexWait(_Atomic uint32_t *addr, uint32_t val) {
+    // returns right away if *addr != val, so a wake-up cannot be lost
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futexWake(_Atomic uint32_t *addr) {
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/*
+Called after publishing an index. The seq_cst fence pairs with the one
+in ringBufferWaitFor*(): either the sleeper sees the new index before
+it sleeps, or we see its waiting flag and wake it.
+*/
+static inline void wakeConsumer(ringBuffer_t *rb) {
+    if(rb->waitPolicy != RING_WAIT_PARK) {
+        return;
+    }
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&rb->consumerWaiting, memory_order_relaxed)) {
+        futexWake(&rb->headIdx);
+    }
+}
+
+static inline void wakeProducer(ringBuffer_t *rb) {
+    if(rb->waitPolicy != RING_WAIT_PARK) {
+        return;
+    }
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&rb->producerWaiting, memory_order_relaxed)) {
+        futexWake(&rb->tailIdx);
+    }
+}
+
+/* Producer side only */
+void ringBufferWaitForSpace(ringBuffer_t *rb, uint32_t *spins) {
+    uint32_t head, tail;
+
+    if(rb->waitPolicy == RING_WAIT_SPIN || ++*spins < RING_SPIN_LIMIT) {
+        cpuRelax();
+        return;
+    }
+
+    if(rb->waitPolicy == RING_WAIT_YIELD) {
+        sched_yield();
+        return;
+    }
+
+    head = atomic_load_explicit(&rb->headIdx, memory_order_relaxed);
+    atomic_store_explicit(&rb->producerWaiting, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
 
-void ringBufferInit() {
-    headIdx = 0;
-    tailIdx = 0;
+    // sleep only if the ring is still full with the tail we just read
+    tail = atomic_load_explicit(&rb->tailIdx, memory_order_relaxed);
+    if(head - tail > rb->mask) {
+        futexWait(&rb->tailIdx, tail);
+    }
+
+    atomic_store_explicit(&rb->producerWaiting, 0, memory_order_relaxed);
+    *spins = 0;
 }
 
-uint32_t isBufferFull() {
-    if((headIdx + 1) % RING_BUFFER_SIZE == tailIdx) {
-        return  BUFFER_IS_FULL;
+/* Consumer side only */
+void ringBufferWaitForData(ringBuffer_t *rb, uint32_t *spins) {
+    uint32_t head, tail;
+
+    if(rb->waitPolicy == RING_WAIT_SPIN || ++*spins < RING_SPIN_LIMIT) {
+        cpuRelax();
+        return;
+    }
+
+    if(rb->waitPolicy == RING_WAIT_YIELD) {
+        sched_yield();
+        return;
+    }
+
+    tail = atomic_load_explicit(&rb->tailIdx, memory_order_relaxed);
+    atomic_store_explicit(&rb->consumerWaiting, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // sleep only if the ring is still empty with the head we just read
+    head = atomic_load_explicit(&rb->headIdx, memory_order_relaxed);
+    if(head == tail) {
+        futexWait(&rb->headIdx, head);
+    }
+
+    atomic_store_explicit(&rb->consumerWaiting, 0, memory_order_relaxed);
+    *spins = 0;
+}
+
+void ringBufferFree(ringBuffer_t *rb) {
+    free(rb->buffer);
+    rb->buffer = NULL;
+}
+
+uint32_t isBufferFull(ringBuffer_t *rb) {
+    uint32_t head = atomic_load_explicit(&rb->headIdx, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&rb->tailIdx, memory_order_acquire);
+
+    if(head - tail > rb->mask) {
+        return BUFFER_IS_FULL;
     }
 
     return BUFFER_NOT_FULL;
 }
 
-uint32_t isBufferEmpty() {
-    if(headIdx == tailIdx) {
+uint32_t isBufferEmpty(ringBuffer_t *rb) {
+    uint32_t head = atomic_load_explicit(&rb->headIdx, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&rb->tailIdx, memory_order_relaxed);
+
+    if(head == tail) {
         return BUFFER_IS_EMPTY;
     }
 
     return BUFFER_NOT_EMPTY;
 }
 
-uint32_t writeToBuffer(int data) {
-    if(isBufferFull()) {
-        return ACCESS_FAIL;
+/* Producer side only */
+uint32_t writeToBuffer(ringBuffer_t *rb, const void *data) {
+    uint32_t head = atomic_load_explicit(&rb->headIdx, memory_order_relaxed);
+
+    // only look at the consumer's line when our cached copy says full
+    if(head - rb->cachedTailIdx > rb->mask) {
+        rb->cachedTailIdx = atomic_load_explicit(&rb->tailIdx, memory_order_acquire);
+        if(head - rb->cachedTailIdx > rb->mask) {
+            return ACCESS_FAIL;
+        }
     }
 
-    ringBuffer[headIdx] = data;
-    headIdx = (headIdx + 1) % RING_BUFFER_SIZE;
-    
+    memcpy(rb->buffer + (size_t)(head & rb->mask) * rb->elemSize, data, rb->elemSize);
+    // release: the slot contents are visible before the new head
+    atomic_store_explicit(&rb->headIdx, head + 1, memory_order_release);
+    wakeConsumer(rb);
+
     return ACCESS_SUCCESS;
 }
 
-uint32_t readFromBuffer(int *data) {
-    if(isBufferEmpty()) {
-        return ACCESS_FAIL;
+/* Consumer side only */
+uint32_t readFromBuffer(ringBuffer_t *rb, void *data) {
+    uint32_t tail = atomic_load_explicit(&rb->tailIdx, memory_order_relaxed);
+
+    // only look at the producer's line when our cached copy says empty
+    if(tail == rb->cachedHeadIdx) {
+        rb->cachedHeadIdx = atomic_load_explicit(&rb->headIdx, memory_order_acquire);
+        if(tail == rb->cachedHeadIdx) {
+            return ACCESS_FAIL;
+        }
     }
 
-    *data = ringBuffer[tailIdx];
-    tailIdx = (tailIdx + 1) % RING_BUFFER_SIZE;
+    memcpy(data, rb->buffer + (size_t)(tail & rb->mask) * rb->elemSize, rb->elemSize);
+    // release: we are done reading the slot before the producer may reuse it
+    atomic_store_explicit(&rb->tailIdx, tail + 1, memory_order_release);
+    wakeProducer(rb);
 
     return ACCESS_SUCCESS;
 }
 
-void *readHandler(void *max) 
+/*
+Copy n elements between the ring, starting at index idx, and dst/src.
+A run crosses the end of the buffer at most once, so this is at most
+two memcpy spans.
+*/
+static void copyToRing(ringBuffer_t *rb, uint32_t idx, const uint8_t *src, uint32_t n) {
+    uint32_t start = idx & rb->mask;
+    uint32_t first = rb->mask + 1 - start;
+
+    if(first > n) {
+        first = n;
+    }
+
+    memcpy(rb->buffer + (size_t)start * rb->elemSize, src, (size_t)first * rb->elemSize);
+    memcpy(rb->buffer, src + (size_t)first * rb->elemSize, (size_t)(n - first) * rb->elemSize);
+}
+
+static void copyFromRing(ringBuffer_t *rb, uint32_t idx, uint8_t *dst, uint32_t n) {
+    uint32_t start = idx & rb->mask;
+    uint32_t first = rb->mask + 1 - start;
+
+    if(first > n) {
+        first = n;
+    }
+
+    memcpy(dst, rb->buffer + (size_t)start * rb->elemSize, (size_t)first * rb->elemSize);
+    memcpy(dst + (size_t)first * rb->elemSize, rb->buffer, (size_t)(n - first) * rb->elemSize);
+}
+
+/* Producer side only */
+uint32_t writeBatch(ringBuffer_t *rb, const void *data, uint32_t n) {
+    uint32_t head = atomic_load_explicit(&rb->headIdx, memory_order_relaxed);
+    uint32_t space = rb->mask + 1 - (head - rb->cachedTailIdx);
+
+    if(space < n) {
+        rb->cachedTailIdx = atomic_load_explicit(&rb->tailIdx, memory_order_acquire);
+        space = rb->mask + 1 - (head - rb->cachedTailIdx);
+    }
+
+    if(n > space) {
+        n = space;
+    }
+    if(n == 0) {
+        return 0;
+    }
+
+    copyToRing(rb, head, data, n);
+    // one publish for the whole burst
+    atomic_store_explicit(&rb->headIdx, head + n, memory_order_release);
+    wakeConsumer(rb);
+
+    return n;
+}
+
+/* Consumer side only */
+uint32_t readBatch(ringBuffer_t *rb, void *data, uint32_t max) {
+    uint32_t tail = atomic_load_explicit(&rb->tailIdx, memory_order_relaxed);
+    uint32_t avail = rb->cachedHeadIdx - tail;
+
+    if(avail < max) {
+        rb->cachedHeadIdx = atomic_load_explicit(&rb->headIdx, memory_order_acquire);
+        avail = rb->cachedHeadIdx - tail;
+    }
+
+    if(max > avail) {
+        max = avail;
+    }
+    if(max == 0) {
+        return 0;
+    }
+
+    copyFromRing(rb, tail, data, max);
+    atomic_store_explicit(&rb->tailIdx, tail + max, memory_order_release);
+    wakeProducer(rb);
+
+    return max;
+}
+
+void writeToBufferBlocking(ringBuffer_t *rb, const void *data) {
+    uint32_t spins = 0;
+
+    while(writeToBuffer(rb, data) == ACCESS_FAIL) {
+        ringBufferWaitForSpace(rb, &spins);
+    }
+}
+
+void readFromBufferBlocking(ringBuffer_t *rb, void *data) {
+    uint32_t spins = 0;
+
+    while(readFromBuffer(rb, data) == ACCESS_FAIL) {
+        ringBufferWaitForData(rb, &spins);
+    }
+}
+
+/* Demo, left out when the queue is linked into ring_bench */
+#ifndef RING_BUFFER_NO_MAIN
+#define DEMO_MAX_BATCH      64
+
+typedef struct {
+    ringBuffer_t *rb;
+    uint32_t maxNum;
+    uint32_t batch;
+} threadArg_t;
+
+void *readHandler(void *arg)
 {
-    int maxNum = (int) max;
-    int buffer, r;
+    threadArg_t *t = arg;
+    uint32_t buffer[DEMO_MAX_BATCH], expected = 1;
+    uint32_t i, n, spins = 0;
+
+    while(expected <= t->maxNum) {
+        if(t->batch > 1) {
+            n = readBatch(t->rb, buffer, t->batch);
+        } else {
+            n = readFromBuffer(t->rb, buffer) == ACCESS_SUCCESS;
+        }
 
-    while(1) {
-        r = readFromBuffer(&buffer);
-        if(r == ACCESS_SUCCESS) {
-            printf("Read value %d\n", buffer);
+        if(n == 0) {
+            ringBufferWaitForData(t->rb, &spins);
+            continue;
+        }
+        spins = 0;
 
-            if(buffer == maxNum) {
-                break;
+        for(i = 0; i < n; i++, expected++) {
+            if(buffer[i] != expected) {
+                printf("ERROR: read %u, expected %u\n", buffer[i], expected);
+                exit(EXIT_FAILURE);
             }
         }
     }
 
+    printf("Read %u values in order\n", t->maxNum);
     pthread_exit(NULL);
 }
 
-void *writeHandler(void *max)
+void *writeHandler(void *arg)
 {
-    int r;
-    int maxNum = (int) max;
-    int counter = 1;
-
-    while(counter <= maxNum) {
-        r = writeToBuffer(counter);
-        if(r == ACCESS_SUCCESS) {
-            printf("Wrote value %d\n", counter);
-            counter++;
+    threadArg_t *t = arg;
+    uint32_t buffer[DEMO_MAX_BATCH], counter = 1;
+    uint32_t i, n, want, spins = 0;
+
+    while(counter <= t->maxNum) {
+        want = t->maxNum - counter + 1;
+        if(want > t->batch) {
+            want = t->batch;
+        }
+        for(i = 0; i < want; i++) {
+            buffer[i] = counter + i;
+        }
+
+        if(want > 1) {
+            n = writeBatch(t->rb, buffer, want);
+        } else {
+            n = writeToBuffer(t->rb, buffer) == ACCESS_SUCCESS;
+        }
+
+        if(n == 0) {
+            ringBufferWaitForSpace(t->rb, &spins);
+        } else {
+            spins = 0;
         }
+        counter += n;
     }
 
     pthread_exit(NULL);
@@ -97,13 +374,36 @@ void handle_sigint(int sig)
 
 int main(int argc, char **argv) {
     int ret;
-    uint32_t target = atoi(argv[1]);
-    ringBufferInit();
+    ringBuffer_t rb;
+    threadArg_t arg;
     pthread_t threads[MAX_NUM_OF_THREADS];
 
+    if(argc < 2) {
+        printf("Usage: %s <count> [batch] [spin|yield|park]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(ringBufferInit(&rb, sizeof(uint32_t), RING_BUFFER_SIZE)) {
+        printf("ERROR: ring buffer init failure\n");
+        exit(EXIT_FAILURE);
+    }
+    arg.rb = &rb;
+    arg.maxNum = atoi(argv[1]);
+    arg.batch = argc > 2 ? atoi(argv[2]) : 1;
+    if(arg.batch < 1 || arg.batch > DEMO_MAX_BATCH) {
+        printf("ERROR: batch must be 1..%d\n", DEMO_MAX_BATCH);
+        exit(EXIT_FAILURE);
+    }
+
+    if(argc > 3 && !strcmp(argv[3], "yield")) {
+        ringBufferSetWaitPolicy(&rb, RING_WAIT_YIELD);
+    } else if(argc > 3 && !strcmp(argv[3], "park")) {
+        ringBufferSetWaitPolicy(&rb, RING_WAIT_PARK);
+    }
+
     signal(SIGINT, handle_sigint);
-    
-    ret = pthread_create(&threads[READ_THREAD_IDX], NULL, readHandler, (void *) (size_t)target);
+
+    ret = pthread_create(&threads[READ_THREAD_IDX], NULL, readHandler, &arg);
     if(ret) {
         printf("ERROR: Reading thread creation failure\n");
         exit(EXIT_FAILURE);
@@ -111,9 +411,9 @@ int main(int argc, char **argv) {
         printf("reading thread created\n");
     }
 
-    ret = pthread_create(&threads[WRITE_THREAD_IDX], NULL, writeHandler, (void *) (size_t)target);
+    ret = pthread_create(&threads[WRITE_THREAD_IDX], NULL, writeHandler, &arg);
     if(ret) {
-        printf("ERROR: Reading thread creation failure\n");
+        printf("ERROR: Writing thread creation failure\n");
         exit(EXIT_FAILURE);
     } else {
         printf("writing thread created\n");
@@ -122,10 +422,8 @@ int main(int argc, char **argv) {
     pthread_join(threads[READ_THREAD_IDX], NULL);
     pthread_join(threads[WRITE_THREAD_IDX], NULL);
 
+    ringBufferFree(&rb);
+
     return 0;
 }
-
-
-
-
-
+#endif
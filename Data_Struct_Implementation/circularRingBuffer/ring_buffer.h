@@ -1,13 +1,19 @@
+#pragma once
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
-#define RING_BUFFER_SIZE    24
+#define RING_BUFFER_SIZE    256 // must be a power of two
+#define CACHE_LINE_SIZE     64
 #define BUFFER_IS_FULL      1
 #define BUFFER_NOT_FULL     0
 #define BUFFER_IS_EMPTY     1
 #define BUFFER_NOT_EMPTY    0
 #define ACCESS_SUCCESS      1
 #define ACCESS_FAIL         0
+#define RING_SPIN_LIMIT     128 // spins before yielding/parking
 
 typedef enum thread_idx {
     READ_THREAD_IDX = 0,
@@ -15,3 +21,75 @@ typedef enum thread_idx {
     MAX_NUM_OF_THREADS = 2
 } THREAD_IDX;
 
+/* Tell the core we are spinning (frees SMT resources, avoids memory-order nukes) */
+static inline void cpuRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+/*
+What a thread does while the ring is full (producer) or empty (consumer):
+  RING_WAIT_SPIN   busy-spin, lowest latency, burns a core
+  RING_WAIT_YIELD  spin RING_SPIN_LIMIT times, then sched_yield()
+  RING_WAIT_PARK   spin RING_SPIN_LIMIT times, then sleep on a futex;
+                   the other side only issues FUTEX_WAKE when a waiter
+                   has announced itself
+*/
+typedef enum {
+    RING_WAIT_SPIN = 0,
+    RING_WAIT_YIELD,
+    RING_WAIT_PARK
+} ringWaitPolicy_t;
+
+/*
+Single-producer/single-consumer ring.
+
+headIdx and tailIdx are free-running counters; the slot is (idx & mask)
+and (headIdx - tailIdx) is the number of elements in the ring, so every
+slot is usable. Each index lives on its own cache line together with the
+owner's cached copy of the opposite index, so the two threads only touch
+each other's line when the cached copy says the ring looks full/empty.
+*/
+typedef struct {
+    // written by the producer only
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t headIdx;
+    uint32_t cachedTailIdx;
+
+    // written by the consumer only
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t tailIdx;
+    uint32_t cachedHeadIdx;
+
+    // set only around a futex sleep, kept off the hot index lines
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t consumerWaiting;
+    _Atomic uint32_t producerWaiting;
+
+    // read-only after ringBufferInit()
+    _Alignas(CACHE_LINE_SIZE) uint32_t mask;
+    uint32_t elemSize;
+    ringWaitPolicy_t waitPolicy;
+    uint8_t *buffer;
+} ringBuffer_t;
+
+int ringBufferInit(ringBuffer_t *rb, uint32_t elemSize, uint32_t capacity);
+void ringBufferFree(ringBuffer_t *rb);
+/* Call before the producer/consumer threads start, default RING_WAIT_SPIN */
+void ringBufferSetWaitPolicy(ringBuffer_t *rb, ringWaitPolicy_t policy);
+uint32_t isBufferFull(ringBuffer_t *rb);
+uint32_t isBufferEmpty(ringBuffer_t *rb);
+uint32_t writeToBuffer(ringBuffer_t *rb, const void *data);
+uint32_t readFromBuffer(ringBuffer_t *rb, void *data);
+
+/* Move up to n elements at once, return how many were moved */
+uint32_t writeBatch(ringBuffer_t *rb, const void *data, uint32_t n);
+uint32_t readBatch(ringBuffer_t *rb, void *data, uint32_t max);
+
+/* Back off once after a failed write/read, spins counts the failures in a row */
+void ringBufferWaitForSpace(ringBuffer_t *rb, uint32_t *spins);
+void ringBufferWaitForData(ringBuffer_t *rb, uint32_t *spins);
+
+/* Block according to the wait policy until the element is moved */
+void writeToBufferBlocking(ringBuffer_t *rb, const void *data);
+void readFromBufferBlocking(ringBuffer_t *rb, void *data);
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+Hash functions shared by the tables. The tables index with the top bits
+of the hash, so a function must at least mix well into its high bits.
+*/
+typedef uint32_t (*hashFunc)(uint32_t key);
+
+/* One multiply by 2^32/phi: only the top bits are good, cheap and fine for most keys */
+static inline uint32_t hashFibonacci32(uint32_t key) {
+   return key * 2654435769u;
+}
+
+/* murmur3 finalizer: every bit of the key affects every bit of the hash */
+static inline uint32_t hashMix32(uint32_t key) {
+   key ^= key >> 16;
+   key *= 0x85ebca6bu;
+   key ^= key >> 13;
+   key *= 0xc2b2ae35u;
+   key ^= key >> 16;
+   return key;
+}
+
+static inline uint64_t hashMix64(uint64_t key) {
+   key ^= key >> 33;
+   key *= 0xff51afd7ed558ccdull;
+   key ^= key >> 33;
+   key *= 0xc4ceb9fe1a85ec53ull;
+   key ^= key >> 33;
+   return key;
+}
+
+#define HASH_P0 0xa0761d6478bd642full
+#define HASH_P1 0xe7037ed1a0b428dbull
+#define HASH_P2 0x8ebc6af09c88c6e3ull
+
+/* 64x64 multiply folded back to 64 bits, the mixing step of hashBytes */
+static inline uint64_t hashMum(uint64_t a, uint64_t b) {
+   __uint128_t r = (__uint128_t)a * b;
+
+   return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t hashRead64(const uint8_t *p) {
+   uint64_t v;
+
+   memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+static inline uint64_t hashRead32(const uint8_t *p) {
+   uint32_t v;
+
+   memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+/*
+Byte strings, in the style of wyhash: 16 bytes are folded in with one
+multiply, and long strings run two independent lanes so the multiplies
+of one step overlap. Short keys take no loop, only overlapping loads.
+*/
+static inline uint64_t hashBytes(const void *data, size_t len, uint64_t seed) {
+   const uint8_t *p = data;
+   uint64_t s0 = seed ^ HASH_P0, s1 = seed ^ HASH_P1, a, b;
+   size_t left = len;
+
+   if(left > 32) {
+      do {
+         s0 = hashMum(hashRead64(p) ^ HASH_P1, hashRead64(p + 8) ^ s0);
+         s1 = hashMum(hashRead64(p + 16) ^ HASH_P2, hashRead64(p + 24) ^ s1);
+         p += 32;
+         left -= 32;
+      } while(left > 32);
+      s0 ^= s1;
+   }
+
+   if(left > 16) {
+      s0 = hashMum(hashRead64(p) ^ HASH_P1, hashRead64(p + 8) ^ s0);
+      p += 16;
+      left -= 16;
+   }
+
+   // the last 1..16 bytes, the two loads may overlap
+   if(left >= 8) {
+      a = hashRead64(p);
+      b = hashRead64(p + left - 8);
+   } else if(left >= 4) {
+      a = hashRead32(p);
+      b = hashRead32(p + left - 4);
+   } else if(left > 0) {
+      a = (uint64_t)p[0] << 16 | (uint64_t)p[left / 2] << 8 | p[left - 1];
+      b = 0;
+   } else {
+      a = b = 0;
+   }
+
+   return hashMum(hashMum(a ^ HASH_P1, b ^ s0) ^ len, HASH_P2);
+}
@@ -1,135 +1,360 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <time.h>
 
-#define SIZE 20
+#include "hash.h"
 
+#define INITIAL_SIZE 16        // power of two
+#define DEFAULT_MAX_LOAD 85    // percent
+#define MAX_MAX_LOAD 95        // Robin Hood copes well, but probes blow up near 100%
+#define SEARCH_BATCH 16        // keys in flight in searchBatch
+
+/*
+Items live inline in the slot array, no per-item allocation.
+dist is the probe distance + 1, so a zeroed slot is empty.
+*/
 struct DataItem {
-   int data;   
    int key;
+   int data;
+   uint32_t dist;
+};
+
+struct HashTable {
+   struct DataItem *slots;
+   uint32_t size;      // power of two
+   uint32_t count;
+   uint32_t maxLoad;   // percent
+   hashFunc hash;
 };
 
-struct DataItem* hashArray[SIZE]; 
-struct DataItem* dummyItem;
-struct DataItem* item;
-
-int hashCode(int key) {
-   return key % SIZE;
-}
-
-struct DataItem *search(int key) {
-   //get the hash 
-   int hashIndex = hashCode(key);  
-	
-   //move in array until an empty 
-   while(hashArray[hashIndex] != NULL) {
-	
-      if(hashArray[hashIndex]->key == key)
-         return hashArray[hashIndex]; 
-			
-      //go to next cell
-      ++hashIndex;
-		
-      //wrap around the table
-      hashIndex %= SIZE;
-   }        
-	
-   return NULL;        
-}
-
-void insert(int key,int data) {
-
-   struct DataItem *item = (struct DataItem*) malloc(sizeof(struct DataItem));
-   item->data = data;  
-   item->key = key;
-
-   //get the hash 
-   int hashIndex = hashCode(key);
-
-   //move in array until an empty or deleted cell
-   while(hashArray[hashIndex] != NULL && hashArray[hashIndex]->key != -1) {
-      //go to next cell
-      ++hashIndex;
-		
-      //wrap around the table
-      hashIndex %= SIZE;
-   }
-	
-   hashArray[hashIndex] = item;
-}
-
-struct DataItem* delete(struct DataItem* item) {
-   int key = item->key;
-
-   //get the hash 
-   int hashIndex = hashCode(key);
-
-   //move in array until an empty
-   while(hashArray[hashIndex] != NULL) {
-	
-      if(hashArray[hashIndex]->key == key) {
-         struct DataItem* temp = hashArray[hashIndex]; 
-			
-         //assign a dummy item at deleted position
-         hashArray[hashIndex] = dummyItem; 
-         return temp;
+static uint32_t hashCode(struct HashTable *ht, int key) {
+   // the top bits of the hash pick the home slot
+   uint32_t shift = 32 - __builtin_ctz(ht->size);
+
+   return shift == 32 ? 0 : ht->hash((uint32_t)key) >> shift;
+}
+
+/* hash NULL is hashMix32, safe for any key set; hashFibonacci32 is cheaper for nearly sequential keys */
+bool initTable(struct HashTable *ht, uint32_t maxLoad, hashFunc hash) {
+   if(maxLoad == 0 || maxLoad > MAX_MAX_LOAD)
+      maxLoad = DEFAULT_MAX_LOAD;
+
+   ht->slots = calloc(INITIAL_SIZE, sizeof(struct DataItem));
+   ht->size = INITIAL_SIZE;
+   ht->count = 0;
+   ht->maxLoad = maxLoad;
+   ht->hash = hash ? hash : hashMix32;
+
+   return ht->slots != NULL;
+}
+
+void freeTable(struct HashTable *ht) {
+   free(ht->slots);
+   ht->slots = NULL;
+   ht->size = ht->count = 0;
+}
+
+/* Probe from hashIndex, the home slot of key */
+static struct DataItem *searchFrom(struct HashTable *ht, int key, uint32_t hashIndex) {
+   uint32_t mask = ht->size - 1;
+   uint32_t dist;
+
+   for(dist = 1; ; dist++) {
+      struct DataItem *slot = &ht->slots[hashIndex];
+
+      // an item closer to home than we are now means the key would have taken its place
+      if(slot->dist < dist)
+         return NULL;
+
+      if(slot->key == key)
+         return slot;
+
+      hashIndex = (hashIndex + 1) & mask;
+   }
+}
+
+/* Valid until the next insert or delete, both may move items */
+struct DataItem *search(struct HashTable *ht, int key) {
+   return searchFrom(ht, key, hashCode(ht, key));
+}
+
+/*
+Looks up n keys, out[i] as search(keys[i]), and returns how many were found.
+Home slots of SEARCH_BATCH keys are hashed and prefetched before any of
+them is probed, so their cache misses overlap instead of queueing up.
+*/
+uint32_t searchBatch(struct HashTable *ht, const int *keys, uint32_t n, struct DataItem **out) {
+   uint32_t hashIndex[SEARCH_BATCH];
+   uint32_t found = 0, i, j, m;
+
+   for(i = 0; i < n; i += m) {
+      m = n - i < SEARCH_BATCH ? n - i : SEARCH_BATCH;
+
+      for(j = 0; j < m; j++) {
+         hashIndex[j] = hashCode(ht, keys[i + j]);
+         __builtin_prefetch(&ht->slots[hashIndex[j]]);
+      }
+
+      for(j = 0; j < m; j++) {
+         out[i + j] = searchFrom(ht, keys[i + j], hashIndex[j]);
+         found += out[i + j] != NULL;
       }
-		
-      //go to next cell
-      ++hashIndex;
-		
-      //wrap around the table
-      hashIndex %= SIZE;
-   }      
-	
-   return NULL;        
-}
-
-void display() {
-   int i = 0;
-	
-   for(i = 0; i<SIZE; i++) {
-	
-      if(hashArray[i] != NULL)
-         printf(" (%d,%d)",hashArray[i]->key,hashArray[i]->data);
+   }
+   return found;
+}
+
+/* Robin Hood: take the slot of any item that is closer to home, and carry it on */
+static void place(struct HashTable *ht, struct DataItem item) {
+   uint32_t mask = ht->size - 1;
+   uint32_t hashIndex = hashCode(ht, item.key);
+   struct DataItem tmp;
+
+   for(item.dist = 1; ; item.dist++) {
+      struct DataItem *slot = &ht->slots[hashIndex];
+
+      if(slot->dist == 0) {
+         *slot = item;
+         return;
+      }
+
+      if(slot->dist < item.dist) {
+         tmp = *slot;
+         *slot = item;
+         item = tmp;
+      }
+
+      hashIndex = (hashIndex + 1) & mask;
+   }
+}
+
+static bool resize(struct HashTable *ht, uint32_t size) {
+   struct DataItem *old = ht->slots;
+   uint32_t oldSize = ht->size, i;
+
+   ht->slots = calloc(size, sizeof(struct DataItem));
+   if(ht->slots == NULL) {
+      ht->slots = old;
+      return false;
+   }
+   ht->size = size;
+
+   for(i = 0; i < oldSize; i++) {
+      if(old[i].dist)
+         place(ht, old[i]);
+   }
+
+   free(old);
+   return true;
+}
+
+/* Adds the key or updates its data, false only when out of memory */
+bool insert(struct HashTable *ht, int key, int data) {
+   struct DataItem *item = search(ht, key);
+
+   if(item != NULL) {
+      item->data = data;
+      return true;
+   }
+
+   if((uint64_t)(ht->count + 1) * 100 > (uint64_t)ht->size * ht->maxLoad) {
+      if(!resize(ht, ht->size * 2))
+         return false;
+   }
+
+   place(ht, (struct DataItem){ .key = key, .data = data });
+   ht->count++;
+   return true;
+}
+
+/* Backward shift: pull the following items one step back, no tombstones */
+bool delete(struct HashTable *ht, int key) {
+   uint32_t mask = ht->size - 1;
+   struct DataItem *item = search(ht, key);
+   uint32_t hashIndex, next;
+
+   if(item == NULL)
+      return false;
+
+   hashIndex = item - ht->slots;
+   for(;;) {
+      next = (hashIndex + 1) & mask;
+
+      // stop at an empty slot or an item already at home
+      if(ht->slots[next].dist <= 1)
+         break;
+
+      ht->slots[hashIndex] = ht->slots[next];
+      ht->slots[hashIndex].dist--;
+      hashIndex = next;
+   }
+
+   ht->slots[hashIndex].dist = 0;
+   ht->count--;
+   return true;
+}
+
+void display(struct HashTable *ht) {
+   uint32_t i = 0;
+
+   for(i = 0; i<ht->size; i++) {
+
+      if(ht->slots[i].dist)
+         printf(" (%d,%d)",ht->slots[i].key,ht->slots[i].data);
       else
          printf(" ~~ ");
    }
-	
+
    printf("\n");
 }
 
-int main() {
-   dummyItem = (struct DataItem*) malloc(sizeof(struct DataItem));
-   dummyItem->data = -1;  
-   dummyItem->key = -1; 
-
-   insert(1, 20);
-   insert(2, 70);
-   insert(42, 80);
-   insert(4, 25);
-   insert(12, 44);
-   insert(14, 32);
-   insert(17, 11);
-   insert(13, 78);
-   insert(37, 97);
-
-   display();
-   item = search(37);
+static void check_item(struct HashTable *ht, int key) {
+   struct DataItem *item = search(ht, key);
 
    if(item != NULL) {
       printf("Element found: %d\n", item->data);
    } else {
-      printf("Element not found\n");
+      printf("Element with key %d not found\n", key);
    }
+}
 
-   delete(item);
-   item = search(37);
+#define STRESS_KEYS 100000
+#define PROBE_KEYS 50000
+#define PROBE_SUBS 224
+#define BENCH_KEYS (1 << 21)       // 4M slots, far bigger than L2
+#define BENCH_LOOKUPS (1 << 22)
 
-   if(item != NULL) {
-      printf("Element found: %d\n", item->data);
-   } else {
-      printf("Element not found\n");
+static double now(void) {
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Average and longest probe for keys (id << shift) | sub, PROBE_SUBS subs per id */
+static void probeStats(hashFunc hash, const char *name, uint32_t shift) {
+   struct HashTable ht;
+   uint64_t total = 0;
+   uint32_t longest = 0, i;
+
+   if(!initTable(&ht, DEFAULT_MAX_LOAD, hash)) {
+      printf("ERROR: table allocation failure\n");
+      exit(EXIT_FAILURE);
+   }
+   for(i = 0; i < PROBE_KEYS; i++)
+      insert(&ht, (i / PROBE_SUBS) << shift | i % PROBE_SUBS, i);
+
+   for(i = 0; i < ht.size; i++) {
+      total += ht.slots[i].dist;
+      if(ht.slots[i].dist > longest)
+         longest = ht.slots[i].dist;
+   }
+   printf("%-9s id << %-2u probe avg %.2f, longest %u\n", name, shift, (double)total / ht.count, longest);
+   freeTable(&ht);
+}
+
+/* Random lookups, half of them misses, one by one and then batched */
+static void benchSearch(void) {
+   static int keys[BENCH_LOOKUPS];
+   static struct DataItem *out[BENCH_LOOKUPS];
+   struct HashTable ht;
+   uint32_t x = 1, found = 0, batchFound, i;
+   double start, single, batch;
+
+   if(!initTable(&ht, DEFAULT_MAX_LOAD, NULL)) {
+      printf("ERROR: table allocation failure\n");
+      exit(EXIT_FAILURE);
+   }
+   for(i = 0; i < BENCH_KEYS; i++)
+      insert(&ht, i, i);
+
+   for(i = 0; i < BENCH_LOOKUPS; i++) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      keys[i] = x % (2 * BENCH_KEYS);
    }
-}
\ No newline at end of file
+
+   start = now();
+   for(i = 0; i < BENCH_LOOKUPS; i++)
+      found += search(&ht, keys[i]) != NULL;
+   single = now() - start;
+
+   start = now();
+   batchFound = searchBatch(&ht, keys, BENCH_LOOKUPS, out);
+   batch = now() - start;
+
+   for(i = 0; i < BENCH_LOOKUPS; i++) {
+      if(out[i] != search(&ht, keys[i]) || batchFound != found) {
+         printf("ERROR: batched lookup of key %d differs\n", keys[i]);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   printf("%u lookups: %.1f ns each one by one, %.1f ns batched\n", BENCH_LOOKUPS,
+         single * 1e9 / BENCH_LOOKUPS, batch * 1e9 / BENCH_LOOKUPS);
+   freeTable(&ht);
+}
+
+int main() {
+   struct HashTable ht;
+   uint32_t maxDist = 0, i;
+   int key;
+
+   if(!initTable(&ht, DEFAULT_MAX_LOAD, NULL)) {
+      printf("ERROR: table allocation failure\n");
+      exit(EXIT_FAILURE);
+   }
+
+   insert(&ht, 1, 20);
+   insert(&ht, 2, 70);
+   insert(&ht, 42, 80);
+   insert(&ht, 4, 25);
+   insert(&ht, 12, 44);
+   insert(&ht, 14, 32);
+   insert(&ht, 17, 11);
+   insert(&ht, 13, 78);
+   insert(&ht, 37, 97);
+
+   display(&ht);
+   check_item(&ht, 37);
+
+   delete(&ht, 37);
+   check_item(&ht, 37);
+   check_item(&ht, 17);
+   display(&ht);
+
+   // grow well past the initial size, then delete half
+   for(key = 0; key < STRESS_KEYS; key++)
+      insert(&ht, key * 7, key);
+   for(key = 0; key < STRESS_KEYS; key += 2)
+      delete(&ht, key * 7);
+
+   for(key = 0; key < STRESS_KEYS; key++) {
+      struct DataItem *item = search(&ht, key * 7);
+
+      if((key % 2 == 0) != (item == NULL) || (item != NULL && item->data != key)) {
+         printf("ERROR: key %d wrong after resize/delete\n", key * 7);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   for(i = 0; i < ht.size; i++) {
+      if(ht.slots[i].dist > maxDist)
+         maxDist = ht.slots[i].dist;
+   }
+   printf("%u items in %u slots, longest probe %u\n", ht.count, ht.size, maxDist);
+
+   freeTable(&ht);
+
+   // Fibonacci hashing spreads nearly sequential keys best, but clusters when the ids sit in the high bits: mix32 is the default
+   probeStats(hashFibonacci32, "fibonacci", 8);
+   probeStats(hashMix32, "mix32", 8);
+   probeStats(hashFibonacci32, "fibonacci", 12);
+   probeStats(hashMix32, "mix32", 12);
+
+   benchSearch();
+   return 0;
+}
@@ -1,140 +1,267 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
 
-#define SIZE 20
+#include "hash.h"
+
+#define INITIAL_SIZE 16        // buckets, power of two
+#define DEFAULT_MAX_LOAD 100   // items per 100 buckets before growing
+#define MIGRATE_BUCKETS 4      // old buckets moved per insert/search/delete
+#define SEARCH_BATCH 16        // keys in flight in searchBatch, migrating like one search
 
 typedef struct DataItem {
-   int data;   
+   int data;
    int key;
    struct DataItem *next;
 } DataItem, *pDataItem;
 
-pDataItem hashArray[SIZE]; 
-pDataItem dummyItem;
-pDataItem item;
+/*
+Growing allocates a table twice the size but moves nothing: every later
+operation migrates MIGRATE_BUCKETS buckets of the old table, so no single
+call pays for the whole rehash. Until the old table is drained, a key
+may live in either table.
+*/
+typedef struct {
+   pDataItem *buckets;    // current table
+   uint32_t size;
+   pDataItem *old;        // table being drained, NULL when not growing
+   uint32_t oldSize;
+   uint32_t migrated;     // old buckets below this index are empty
+   uint32_t count;
+   uint32_t maxLoad;
+   hashFunc hash;
+} HashTable;
 
-int hashCode(int key) {
-   return key % SIZE;
-}
+static uint32_t hashCode(HashTable *ht, int key, uint32_t size) {
+   // top bits of the hash, size is a power of two
+   uint32_t shift = 32 - __builtin_ctz(size);
 
-pDataItem search(int key) {
-   //get the hash 
-   int hashIndex = hashCode(key);  
-   pDataItem dummy;
+   return shift == 32 ? 0 : ht->hash((uint32_t)key) >> shift;
+}
 
-   dummy = hashArray[hashIndex];
-   while(dummy) {
-      dummy = hashArray[hashIndex];
+/* hash NULL is hashMix32, see hash.h for the others */
+bool initTable(HashTable *ht, uint32_t maxLoad, hashFunc hash) {
+   ht->buckets = calloc(INITIAL_SIZE, sizeof(pDataItem));
+   ht->size = INITIAL_SIZE;
+   ht->old = NULL;
+   ht->oldSize = 0;
+   ht->migrated = 0;
+   ht->count = 0;
+   ht->maxLoad = maxLoad ? maxLoad : DEFAULT_MAX_LOAD;
+   ht->hash = hash ? hash : hashMix32;
 
-      while (dummy) {
-        if (dummy->key == key)
-            return dummy; 
-	      dummy = dummy->next;
-      }	
-   }        
-	
-   return NULL;        
+   return ht->buckets != NULL;
 }
 
-void insert(int key,int data) {
-   pDataItem dummy;
-   pDataItem item;
+static void freeChains(pDataItem *buckets, uint32_t size) {
+   pDataItem dummy, next;
+   uint32_t i;
 
-   if (search(key)) {
-      printf("Item with the same key %d already exist!\n", key);
-      return;
+   for(i = 0; i < size; i++) {
+      for(dummy = buckets[i]; dummy; dummy = next) {
+         next = dummy->next;
+         free(dummy);
+      }
    }
-   
-   item = (pDataItem) malloc(sizeof(DataItem));
-   item->data = data;  
-   item->key = key;
-   item->next = NULL;
+   free(buckets);
+}
 
-   //get the hash 
-   int hashIndex = hashCode(key);
-   dummy = hashArray[hashIndex];
+void freeTable(HashTable *ht) {
+   freeChains(ht->buckets, ht->size);
+   if(ht->old)
+      freeChains(ht->old, ht->oldSize);
+   ht->buckets = ht->old = NULL;
+   ht->count = 0;
+}
 
-   // If it was empty
-   if (!dummy) {
-       hashArray[hashIndex] = item;
-       return;
-   }
+/* Move up to n old buckets into the current table */
+static void migrate(HashTable *ht, uint32_t n) {
+   pDataItem dummy, next;
+   uint32_t hashIndex;
+
+   while(ht->old && n--) {
+      for(dummy = ht->old[ht->migrated]; dummy; dummy = next) {
+         next = dummy->next;
+         hashIndex = hashCode(ht, dummy->key, ht->size);
+         dummy->next = ht->buckets[hashIndex];
+         ht->buckets[hashIndex] = dummy;
+      }
+      ht->old[ht->migrated] = NULL;
 
-   //move in array until an empty or deleted cell
-   while(dummy && dummy->next) {
-      //go to next cell
-      dummy = dummy->next;
+      if(++ht->migrated == ht->oldSize) {
+         free(ht->old);
+         ht->old = NULL;
+      }
    }
-   dummy->next = item;
 }
 
-void delete(int key) {
-   pDataItem dummy;
-   pDataItem dummy2;
+/* Link pointing at key's item, or at the NULL ending its chain, in one table */
+static pDataItem *findLink(HashTable *ht, pDataItem *buckets, uint32_t size, int key) {
+   pDataItem *link = &buckets[hashCode(ht, key, size)];
 
-   int hashIndex = hashCode(key);
+   while(*link && (*link)->key != key)
+      link = &(*link)->next;
 
-   dummy = hashArray[hashIndex];
+   return link;
+}
 
-   // if key is at the front
-   if (dummy && hashArray[hashIndex]->key == key) {
-      dummy = hashArray[hashIndex];
-      hashArray[hashIndex] = dummy->next;
-      free(dummy);
-      return;
-   }
-   
-   // if key is at the middle or end 
-   while(dummy && dummy->next) {
-
-      // if key is at the mid
-      if(dummy->key == key) {
-         dummy2 = dummy->next;
-         *dummy = *(dummy->next);
-         free(dummy2);
-         return;
+/* Old bucket of key if it has not been migrated yet */
+static pDataItem *oldLink(HashTable *ht, int key) {
+   uint32_t hashIndex;
+
+   if(!ht->old)
+      return NULL;
+
+   hashIndex = hashCode(ht, key, ht->oldSize);
+   if(hashIndex < ht->migrated)
+      return NULL;
+
+   return findLink(ht, ht->old, ht->oldSize, key);
+}
+
+pDataItem search(HashTable *ht, int key) {
+   pDataItem *link;
+
+   migrate(ht, MIGRATE_BUCKETS);
+
+   link = findLink(ht, ht->buckets, ht->size, key);
+   if(*link)
+      return *link;
+
+   link = oldLink(ht, key);
+   return link ? *link : NULL;
+}
+
+/*
+Looks up n keys, out[i] as search(keys[i]), and returns how many were found.
+A chain lookup is two dependent misses, the bucket and then the item, so a
+batch of SEARCH_BATCH keys goes through three passes: hash and prefetch the
+buckets, load the heads and prefetch the items, then walk the chains.
+*/
+uint32_t searchBatch(HashTable *ht, const int *keys, uint32_t n, pDataItem *out) {
+   uint32_t hashIndex[SEARCH_BATCH];
+   uint32_t found = 0, i, j, m;
+   pDataItem dummy, *link;
+
+   for(i = 0; i < n; i += m) {
+      m = n - i < SEARCH_BATCH ? n - i : SEARCH_BATCH;
+      migrate(ht, MIGRATE_BUCKETS);
+
+      for(j = 0; j < m; j++) {
+         hashIndex[j] = hashCode(ht, keys[i + j], ht->size);
+         __builtin_prefetch(&ht->buckets[hashIndex[j]]);
       }
 
-      // if key is at the end
-      if (!dummy->next->next && dummy->next->key == key) {
-         dummy2 = dummy->next;
-         dummy->next = NULL;
-         free(dummy2);
-         return;
+      for(j = 0; j < m; j++) {
+         out[i + j] = ht->buckets[hashIndex[j]];
+         if(out[i + j])
+            __builtin_prefetch(out[i + j]);
       }
 
-      dummy = dummy->next;
+      for(j = 0; j < m; j++) {
+         for(dummy = out[i + j]; dummy && dummy->key != keys[i + j]; dummy = dummy->next)
+            ;
+         // rare while migrating: the key may still sit in its old bucket
+         if(!dummy && (link = oldLink(ht, keys[i + j])))
+            dummy = *link;
+         out[i + j] = dummy;
+         found += dummy != NULL;
+      }
    }
+   return found;
+}
+
+/* False if the key already exists or on allocation failure */
+bool insert(HashTable *ht, int key, int data) {
+   pDataItem item;
+   pDataItem *grown;
+   uint32_t hashIndex;
 
-   // if key is not found
+   if(search(ht, key))
+      return false;
+
+   // start growing; while a migration runs, the old table keeps draining instead
+   if(!ht->old && (uint64_t)(ht->count + 1) * 100 > (uint64_t)ht->size * ht->maxLoad) {
+      grown = calloc(ht->size * 2, sizeof(pDataItem));
+      if(grown) {
+         ht->old = ht->buckets;
+         ht->oldSize = ht->size;
+         ht->migrated = 0;
+         ht->buckets = grown;
+         ht->size *= 2;
+      }
+   }
+
+   item = (pDataItem) malloc(sizeof(DataItem));
+   if(!item)
+      return false;
+   item->data = data;
+   item->key = key;
+
+   // new items always go to the current table
+   hashIndex = hashCode(ht, key, ht->size);
+   item->next = ht->buckets[hashIndex];
+   ht->buckets[hashIndex] = item;
+   ht->count++;
+   return true;
 }
 
-void display() {
-   int i = 0;
+bool delete(HashTable *ht, int key) {
+   pDataItem *link;
    pDataItem dummy;
-	
-   printf("===================\n");
-   for(i = 0; i<SIZE; i++) {
-      dummy = hashArray[i];
+
+   migrate(ht, MIGRATE_BUCKETS);
+
+   link = findLink(ht, ht->buckets, ht->size, key);
+   if(!*link)
+      link = oldLink(ht, key);
+
+   // key is not found
+   if(!link || !*link)
+      return false;
+
+   dummy = *link;
+   *link = dummy->next;
+   free(dummy);
+   ht->count--;
+   return true;
+}
+
+static void displayBuckets(pDataItem *buckets, uint32_t from, uint32_t size) {
+   uint32_t i;
+   pDataItem dummy;
+
+   for(i = from; i<size; i++) {
+      dummy = buckets[i];
       while (dummy) {
          printf(" (%d,%d)",dummy->key,dummy->data);
          dummy = dummy->next;
       }
-      
+
       if (!dummy)
          printf(" ~~ ");
-      
+
       printf("\n");
    }
-	
-    printf("===================\n");
 }
 
-static void check_item(int key) {
+void display(HashTable *ht) {
+   printf("===================\n");
+   displayBuckets(ht->buckets, 0, ht->size);
+   if(ht->old) {
+      printf("--- not migrated yet ---\n");
+      displayBuckets(ht->old, ht->migrated, ht->oldSize);
+   }
+   printf("===================\n");
+}
+
+static void check_item(HashTable *ht, int key) {
    pDataItem item;
-   
-   item = search(key);
+
+   item = search(ht, key);
 
    if(item != NULL) {
       printf("Element found: %d\n", item->data);
@@ -143,41 +270,129 @@ static void check_item(int key) {
    }
 }
 
+#define STRESS_KEYS 200000
+#define BENCH_KEYS (1 << 21)       // millions of buckets and items, far bigger than L2
+#define BENCH_LOOKUPS (1 << 22)
+
+static double now(void) {
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Random lookups, half of them misses, one by one and then batched */
+static void benchSearch(void) {
+   static int keys[BENCH_LOOKUPS];
+   static pDataItem out[BENCH_LOOKUPS];
+   HashTable ht;
+   uint32_t x = 1, found = 0, batchFound, i;
+   double start, single, batch;
+
+   if(!initTable(&ht, DEFAULT_MAX_LOAD, NULL)) {
+      printf("ERROR: table allocation failure\n");
+      exit(EXIT_FAILURE);
+   }
+   // stop halfway through the migration to 4M buckets
+   for(i = 0; i < BENCH_KEYS + BENCH_KEYS / 8; i++)
+      insert(&ht, i, i);
+
+   for(i = 0; i < BENCH_LOOKUPS; i++) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      keys[i] = x % (2 * BENCH_KEYS);
+   }
+
+   // batches must also find keys that still sit in old buckets
+   searchBatch(&ht, keys, BENCH_LOOKUPS / 64, out);
+   for(i = 0; i < BENCH_LOOKUPS / 64; i++) {
+      if(out[i] != search(&ht, keys[i])) {
+         printf("ERROR: batched lookup of key %d differs while migrating\n", keys[i]);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   // finish the migration, both loops should see the same table
+   while(ht.old)
+      migrate(&ht, MIGRATE_BUCKETS);
+
+   start = now();
+   for(i = 0; i < BENCH_LOOKUPS; i++)
+      found += search(&ht, keys[i]) != NULL;
+   single = now() - start;
+
+   start = now();
+   batchFound = searchBatch(&ht, keys, BENCH_LOOKUPS, out);
+   batch = now() - start;
+
+   for(i = 0; i < BENCH_LOOKUPS; i++) {
+      if(out[i] != search(&ht, keys[i]) || batchFound != found) {
+         printf("ERROR: batched lookup of key %d differs\n", keys[i]);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   printf("%u lookups: %.1f ns each one by one, %.1f ns batched\n", BENCH_LOOKUPS,
+         single * 1e9 / BENCH_LOOKUPS, batch * 1e9 / BENCH_LOOKUPS);
+   freeTable(&ht);
+}
+
 int main() {
-   pDataItem item;
+   HashTable ht;
+   int key;
+
+   // any hash.h function plugs in, NULL is hashMix32
+   if(!initTable(&ht, DEFAULT_MAX_LOAD, NULL)) {
+      printf("ERROR: table allocation failure\n");
+      exit(EXIT_FAILURE);
+   }
 
-   insert(1, 20);
-   insert(2, 70);
-   insert(42, 80);
-   insert(4, 25);
-   insert(12, 44);
-   insert(14, 32);
-   insert(17, 11);
-   insert(13, 78);
-   insert(37, 97);
-   insert(107, 27);
-   insert(57, 47);
+   insert(&ht, 1, 20);
+   insert(&ht, 2, 70);
+   insert(&ht, 42, 80);
+   insert(&ht, 4, 25);
+   insert(&ht, 12, 44);
+   insert(&ht, 14, 32);
+   insert(&ht, 17, 11);
+   insert(&ht, 13, 78);
+   insert(&ht, 37, 97);
+   insert(&ht, 107, 27);
+   insert(&ht, 57, 47);
 
    // Check hash table and test search
-   display();
-   check_item(17);
-   check_item(37);
+   display(&ht);
+   check_item(&ht, 17);
+   check_item(&ht, 37);
 
    // Test delete and search a non-exist item
-   delete(37);
-   check_item(37);
-   check_item(17);
-   display();
-
-   // delete first item 
-   insert(77, 438);
-   insert(97, 438);
-   delete(17);
-   display();
-
-   // delete last item
-   delete(97);
-   display();
-   insert(97, 338);
-   display();
+   delete(&ht, 37);
+   check_item(&ht, 37);
+   check_item(&ht, 17);
+
+   // duplicates are refused
+   if(insert(&ht, 17, 1))
+      printf("ERROR: duplicate key inserted\n");
+
+   // grow through many migrations, deleting along the way
+   for(key = 1000; key < 1000 + STRESS_KEYS; key++) {
+      insert(&ht, key, key);
+      if(key % 3 == 0)
+         delete(&ht, key - 500);
+   }
+
+   for(key = 1000; key < 1000 + STRESS_KEYS; key++) {
+      pDataItem item = search(&ht, key);
+      bool deleted = (key + 500) % 3 == 0 && key + 500 < 1000 + STRESS_KEYS;
+
+      if(deleted != (item == NULL) || (item && item->data != key)) {
+         printf("ERROR: key %d wrong after migration\n", key);
+         exit(EXIT_FAILURE);
+      }
+   }
+   printf("%u items in %u buckets%s\n", ht.count, ht.size, ht.old ? ", still migrating" : "");
+
+   freeTable(&ht);
+   benchSearch();
+   return 0;
 }
@@ -0,0 +1,465 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "hash.h"
+
+#define CACHE_LINE 64
+#define STRIPES 64             // writer locks, power of two
+#define SPIN_LIMIT 128
+#define RECLAIM_BATCH 64       // deletes between two reclaim passes
+
+typedef struct DataItem {
+   int data;
+   int key;
+   _Atomic(struct DataItem *) next;
+   struct DataItem *retiredNext;   // readers may still follow next after the unlink
+   uint64_t retiredAt;             // epoch of the reclaim pass that saw it, 0 before
+} DataItem, *pDataItem;
+
+/*
+Every thread that searches gets a record: the epoch it entered the table
+in, 0 while it is outside. A deleted item is freed only once no thread
+is still inside since before the item was unlinked.
+*/
+typedef struct Reader {
+   _Alignas(CACHE_LINE) _Atomic uint64_t epoch;
+   _Atomic bool inUse;             // cleared when its thread exits, for reuse
+   struct Reader *next;
+} Reader;
+
+/* Lock and item count of the buckets whose index is the stripe modulo STRIPES */
+typedef struct {
+   _Alignas(CACHE_LINE) _Atomic uint32_t lock;
+   uint32_t count;
+} Stripe;
+
+/*
+Writers lock the stripe of their bucket, readers take no lock at all:
+items are published with a release store of the link pointing at them,
+so a reader following the links with acquire loads always sees a fully
+built item. The bucket array is sized once by initTable and never moves.
+*/
+typedef struct {
+   _Atomic(pDataItem) *buckets;
+   uint32_t size;
+   Stripe stripes[STRIPES];
+   _Alignas(CACHE_LINE) _Atomic uint64_t epoch;
+   _Atomic(Reader *) readers;
+   pthread_key_t readerKey;
+   _Alignas(CACHE_LINE) _Atomic uint32_t retireLock;
+   pDataItem retired;
+   uint32_t retiredCount;
+} HashTable;
+
+static uint32_t hashCode(int key, uint32_t size) {
+   // top bits of the mixed key, size is a power of two
+   uint32_t shift = 32 - __builtin_ctz(size);
+
+   return shift == 32 ? 0 : hashMix32((uint32_t)key) >> shift;
+}
+
+static void spinLock(_Atomic uint32_t *lock) {
+   uint32_t spins = 0;
+
+   while(atomic_exchange_explicit(lock, 1, memory_order_acquire)) {
+      while(atomic_load_explicit(lock, memory_order_relaxed)) {
+         if(++spins > SPIN_LIMIT)
+            sched_yield();
+      }
+   }
+}
+
+static inline void spinUnlock(_Atomic uint32_t *lock) {
+   atomic_store_explicit(lock, 0, memory_order_release);
+}
+
+static void readerRelease(void *r) {
+   atomic_store_explicit(&((Reader *)r)->inUse, false, memory_order_release);
+}
+
+/* size is the expected number of items, rounded up to a power of two */
+bool initTable(HashTable *ht, uint32_t size) {
+   uint32_t i;
+
+   ht->size = STRIPES;
+   while(ht->size < size && ht->size < (1u << 31))
+      ht->size *= 2;
+
+   ht->buckets = calloc(ht->size, sizeof(*ht->buckets));
+   if(!ht->buckets)
+      return false;
+
+   for(i = 0; i < STRIPES; i++) {
+      atomic_init(&ht->stripes[i].lock, 0);
+      ht->stripes[i].count = 0;
+   }
+   atomic_init(&ht->epoch, 1);
+   atomic_init(&ht->readers, NULL);
+   atomic_init(&ht->retireLock, 0);
+   ht->retired = NULL;
+   ht->retiredCount = 0;
+
+   if(pthread_key_create(&ht->readerKey, readerRelease)) {
+      free(ht->buckets);
+      return false;
+   }
+   return true;
+}
+
+/* Only call once no other thread uses the table any more */
+void freeTable(HashTable *ht) {
+   pDataItem dummy, next;
+   Reader *r, *nextReader;
+   uint32_t i;
+
+   pthread_key_delete(ht->readerKey);
+
+   for(i = 0; i < ht->size; i++) {
+      for(dummy = atomic_load(&ht->buckets[i]); dummy; dummy = next) {
+         next = atomic_load(&dummy->next);
+         free(dummy);
+      }
+   }
+   free(ht->buckets);
+   ht->buckets = NULL;
+
+   for(dummy = ht->retired; dummy; dummy = next) {
+      next = dummy->retiredNext;
+      free(dummy);
+   }
+   ht->retired = NULL;
+
+   for(r = atomic_load(&ht->readers); r; r = nextReader) {
+      nextReader = r->next;
+      free(r);
+   }
+}
+
+static Reader *getReader(HashTable *ht) {
+   Reader *r = pthread_getspecific(ht->readerKey);
+   bool expected;
+
+   if(r)
+      return r;
+
+   // take over the record of a thread that has exited
+   for(r = atomic_load_explicit(&ht->readers, memory_order_acquire); r; r = r->next) {
+      expected = false;
+      if(atomic_compare_exchange_strong(&r->inUse, &expected, true))
+         break;
+   }
+
+   if(!r) {
+      r = aligned_alloc(CACHE_LINE, sizeof(Reader));
+      if(!r)
+         return NULL;
+
+      atomic_init(&r->epoch, 0);
+      atomic_init(&r->inUse, true);
+      r->next = atomic_load_explicit(&ht->readers, memory_order_relaxed);
+      while(!atomic_compare_exchange_weak_explicit(&ht->readers, &r->next, r,
+            memory_order_release, memory_order_relaxed));
+   }
+
+   pthread_setspecific(ht->readerKey, r);
+   return r;
+}
+
+/*
+Sets up the calling thread's reader record, false when out of memory.
+search() does it on first use but can only report that failure as a miss.
+*/
+bool registerReader(HashTable *ht) {
+   return getReader(ht) != NULL;
+}
+
+/*
+False if the key is not there, or if the thread has no reader record yet
+and none can be allocated. Data is copied out since the item may go any time.
+*/
+bool search(HashTable *ht, int key, int *data) {
+   Reader *r = getReader(ht);
+   pDataItem dummy;
+   bool found = false;
+
+   if(!r)
+      return false;
+
+   // announce the epoch before the first load of a link, pairs with the fence in reclaim
+   atomic_store_explicit(&r->epoch, atomic_load_explicit(&ht->epoch, memory_order_acquire),
+         memory_order_relaxed);
+   atomic_thread_fence(memory_order_seq_cst);
+
+   dummy = atomic_load_explicit(&ht->buckets[hashCode(key, ht->size)], memory_order_acquire);
+   while(dummy) {
+      if(dummy->key == key) {
+         *data = dummy->data;
+         found = true;
+         break;
+      }
+      dummy = atomic_load_explicit(&dummy->next, memory_order_acquire);
+   }
+
+   atomic_store_explicit(&r->epoch, 0, memory_order_release);
+   return found;
+}
+
+/*
+Called with the retire lock held. Items retired since the last pass get
+the new epoch: every thread that enters from now on can no longer reach
+them. Items are freed once no thread is inside with an older epoch.
+*/
+static void reclaim(HashTable *ht) {
+   uint64_t epoch = atomic_fetch_add(&ht->epoch, 1) + 1;
+   uint64_t oldest = UINT64_MAX, e;
+   pDataItem *link, dummy;
+   Reader *r;
+
+   for(dummy = ht->retired; dummy; dummy = dummy->retiredNext) {
+      if(!dummy->retiredAt)
+         dummy->retiredAt = epoch;
+   }
+
+   atomic_thread_fence(memory_order_seq_cst);
+   for(r = atomic_load_explicit(&ht->readers, memory_order_acquire); r; r = r->next) {
+      e = atomic_load_explicit(&r->epoch, memory_order_acquire);
+      if(e && e < oldest)
+         oldest = e;
+   }
+
+   link = &ht->retired;
+   while((dummy = *link)) {
+      if(dummy->retiredAt <= oldest) {
+         *link = dummy->retiredNext;
+         free(dummy);
+         ht->retiredCount--;
+      } else {
+         link = &dummy->retiredNext;
+      }
+   }
+}
+
+static void retire(HashTable *ht, pDataItem item) {
+   spinLock(&ht->retireLock);
+   item->retiredAt = 0;
+   item->retiredNext = ht->retired;
+   ht->retired = item;
+   if(++ht->retiredCount % RECLAIM_BATCH == 0)
+      reclaim(ht);
+   spinUnlock(&ht->retireLock);
+}
+
+/* False if the key already exists or on allocation failure */
+bool insert(HashTable *ht, int key, int data) {
+   uint32_t hashIndex = hashCode(key, ht->size);
+   Stripe *s = &ht->stripes[hashIndex & (STRIPES - 1)];
+   _Atomic(pDataItem) *head = &ht->buckets[hashIndex];
+   pDataItem item, dummy;
+
+   item = (pDataItem) malloc(sizeof(DataItem));
+   if(!item)
+      return false;
+   item->data = data;
+   item->key = key;
+
+   spinLock(&s->lock);
+   // only this stripe's writers change the chain, plain walking is enough
+   for(dummy = atomic_load_explicit(head, memory_order_relaxed); dummy;
+         dummy = atomic_load_explicit(&dummy->next, memory_order_relaxed)) {
+      if(dummy->key == key) {
+         spinUnlock(&s->lock);
+         free(item);
+         return false;
+      }
+   }
+
+   atomic_init(&item->next, atomic_load_explicit(head, memory_order_relaxed));
+   atomic_store_explicit(head, item, memory_order_release);
+   s->count++;
+   spinUnlock(&s->lock);
+   return true;
+}
+
+bool delete(HashTable *ht, int key) {
+   uint32_t hashIndex = hashCode(key, ht->size);
+   Stripe *s = &ht->stripes[hashIndex & (STRIPES - 1)];
+   _Atomic(pDataItem) *link = &ht->buckets[hashIndex];
+   pDataItem dummy;
+
+   spinLock(&s->lock);
+   while((dummy = atomic_load_explicit(link, memory_order_relaxed)) && dummy->key != key)
+      link = &dummy->next;
+
+   // key is not found
+   if(!dummy) {
+      spinUnlock(&s->lock);
+      return false;
+   }
+
+   // readers standing on dummy still get through to the rest of the chain
+   atomic_store_explicit(link, atomic_load_explicit(&dummy->next, memory_order_relaxed),
+         memory_order_release);
+   s->count--;
+   spinUnlock(&s->lock);
+
+   retire(ht, dummy);
+   return true;
+}
+
+/* A snapshot: concurrent writers may change it before it returns */
+uint32_t countItems(HashTable *ht) {
+   uint32_t count = 0, i;
+
+   for(i = 0; i < STRIPES; i++) {
+      spinLock(&ht->stripes[i].lock);
+      count += ht->stripes[i].count;
+      spinUnlock(&ht->stripes[i].lock);
+   }
+   return count;
+}
+
+static void check_item(HashTable *ht, int key) {
+   int data;
+
+   if(search(ht, key, &data)) {
+      printf("Element found: %d\n", data);
+   } else {
+      printf("Element with key %d not found\n", key);
+   }
+}
+
+#define STABLE_KEYS 100000     // always in the table while the readers run
+#define CHURN_KEYS 10000       // inserted and deleted over and over by the writer
+#define LOOKUPS 2000000        // per reader
+#define WRITERS 4
+#define MAX_READERS 16
+
+static HashTable table;
+static _Atomic bool stop;
+static _Atomic bool failed;
+
+static void *writerChurn(void *arg) {
+   int key;
+
+   (void)arg;
+   while(!atomic_load_explicit(&stop, memory_order_relaxed)) {
+      for(key = STABLE_KEYS; key < STABLE_KEYS + CHURN_KEYS; key++)
+         insert(&table, key, key * 2);
+      for(key = STABLE_KEYS; key < STABLE_KEYS + CHURN_KEYS; key++)
+         delete(&table, key);
+   }
+   return NULL;
+}
+
+static void *readerLookup(void *arg) {
+   uint32_t x = (uint32_t)(uintptr_t)arg * 2654435769u + 1;
+   int key, data;
+   uint32_t i;
+
+   // a miss must mean the key is gone, not a missing reader record
+   if(!registerReader(&table)) {
+      atomic_store(&failed, true);
+      return NULL;
+   }
+
+   for(i = 0; i < LOOKUPS; i++) {
+      // xorshift, both the stable keys and the churned ones
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      key = x % (STABLE_KEYS + CHURN_KEYS);
+
+      if(search(&table, key, &data) ? data != key * 2 : key < STABLE_KEYS)
+         atomic_store(&failed, true);
+   }
+   return NULL;
+}
+
+static void *writerRange(void *arg) {
+   int first = (int)(uintptr_t)arg * STABLE_KEYS;
+   int key;
+
+   for(key = first; key < first + STABLE_KEYS; key++) {
+      if(!insert(&table, key, key * 2))
+         atomic_store(&failed, true);
+   }
+   return NULL;
+}
+
+static double now(void) {
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main() {
+   pthread_t writer, threads[MAX_READERS];
+   long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+   uint32_t readers, i;
+   double start, elapsed;
+   int key;
+
+   if(!initTable(&table, STABLE_KEYS + CHURN_KEYS)) {
+      printf("ERROR: table allocation failure\n");
+      exit(EXIT_FAILURE);
+   }
+
+   insert(&table, 1, 20);
+   insert(&table, 2, 70);
+   insert(&table, 42, 80);
+   insert(&table, 37, 97);
+   check_item(&table, 37);
+   delete(&table, 37);
+   check_item(&table, 37);
+   check_item(&table, 42);
+   delete(&table, 1);
+   delete(&table, 2);
+   delete(&table, 42);
+
+   // writers on disjoint key ranges, sharing stripes
+   for(i = 0; i < WRITERS; i++)
+      pthread_create(&threads[i], NULL, writerRange, (void *)(uintptr_t)i);
+   for(i = 0; i < WRITERS; i++)
+      pthread_join(threads[i], NULL);
+   if(countItems(&table) != WRITERS * STABLE_KEYS)
+      atomic_store(&failed, true);
+   for(key = STABLE_KEYS; key < WRITERS * STABLE_KEYS; key++)
+      delete(&table, key);
+
+   // lock-free readers against one writer that keeps inserting and deleting, at least 4 to exercise races
+   for(readers = 1; readers <= MAX_READERS && (readers <= cpus || readers <= 4); readers *= 2) {
+      atomic_store(&stop, false);
+      pthread_create(&writer, NULL, writerChurn, NULL);
+
+      start = now();
+      for(i = 0; i < readers; i++)
+         pthread_create(&threads[i], NULL, readerLookup, (void *)(uintptr_t)(i + 1));
+      for(i = 0; i < readers; i++)
+         pthread_join(threads[i], NULL);
+      elapsed = now() - start;
+
+      atomic_store(&stop, true);
+      pthread_join(writer, NULL);
+
+      printf("%2u readers: %6.1f M lookups/s\n", readers, readers * (LOOKUPS / 1e6) / elapsed);
+   }
+
+   if(atomic_load(&failed) || countItems(&table) != STABLE_KEYS) {
+      printf("ERROR: lookups or counts wrong under concurrent writes\n");
+      exit(EXIT_FAILURE);
+   }
+   printf("%u items in %u buckets, %u deleted items awaiting reclaim\n",
+         countItems(&table), table.size, table.retiredCount);
+
+   freeTable(&table);
+   return 0;
+}
@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hash.h"
+
+#define DEFAULT_MAX_LOAD 85    // percent
+#define MAX_MAX_LOAD 95
+#define TABLE_MAGIC 0x31504d4d48534148ull   // "HASHMMP1" on a little endian machine
+#define TABLE_VERSION 1                     // bump on any change to the file layout
+#define TABLE_ALIGN 64                      // slot array offset
+
+enum { HASH_FIBONACCI, HASH_MIX32, HASH_COUNT };
+
+static const hashFunc hashFuncs[HASH_COUNT] = { hashFibonacci32, hashMix32 };
+
+/*
+File layout: the header, then the Robin Hood slot array of hashTable.c at
+header.slots. There are no pointers, only offsets from the start of the
+file, so the file works wherever it gets mapped.
+*/
+struct TableHeader {
+   uint64_t magic;
+   uint32_t version;       // TABLE_VERSION
+   uint32_t slotSize;      // sizeof(struct DataItem) of the builder
+   uint32_t size;          // slots, power of two
+   uint32_t count;
+   uint32_t maxDist;       // longest probe distance, bounds every search
+   uint32_t hash;          // HASH_FIBONACCI or HASH_MIX32
+   uint64_t slots;         // offset of the slot array
+   uint64_t fileSize;
+};
+
+/* dist is the probe distance + 1, so the zeroes of a fresh file are empty slots */
+struct DataItem {
+   int key;
+   int data;
+   uint32_t dist;
+};
+
+struct MappedTable {
+   const struct TableHeader *header;
+   const struct DataItem *slots;
+   uint32_t size;
+   uint32_t maxDist;
+   hashFunc hash;
+   size_t mapSize;
+};
+
+static uint32_t homeOf(hashFunc hash, uint32_t size, int key) {
+   uint32_t shift = 32 - __builtin_ctz(size);
+
+   return shift == 32 ? 0 : hash((uint32_t)key) >> shift;
+}
+
+/* Robin Hood insert into a writable slot array, a key already there gets the new data */
+static void place(struct DataItem *slots, uint32_t size, hashFunc hash, struct DataItem item) {
+   uint32_t mask = size - 1;
+   uint32_t hashIndex = homeOf(hash, size, item.key);
+   struct DataItem tmp;
+
+   for(item.dist = 1; ; item.dist++) {
+      struct DataItem *slot = &slots[hashIndex];
+
+      if(slot->dist == 0) {
+         *slot = item;
+         return;
+      }
+
+      if(slot->dist == item.dist && slot->key == item.key) {
+         slot->data = item.data;
+         return;
+      }
+
+      if(slot->dist < item.dist) {
+         tmp = *slot;
+         *slot = item;
+         item = tmp;
+      }
+
+      hashIndex = (hashIndex + 1) & mask;
+   }
+}
+
+/* The rename only lasts once the directory entry is on disk too */
+static bool syncDir(const char *path) {
+   char dir[4096];
+   const char *slash = strrchr(path, '/');
+   int fd, err;
+
+   if(slash == NULL)
+      strcpy(dir, ".");
+   else if(slash == path)
+      strcpy(dir, "/");
+   else
+      snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+
+   fd = open(dir, O_RDONLY | O_DIRECTORY);
+   if(fd < 0)
+      return false;
+   if(fsync(fd) < 0) {
+      err = errno;
+      close(fd);
+      errno = err;
+      return false;
+   }
+   return close(fd) == 0;
+}
+
+/*
+Writes n items to path. The table is built in path.tmp and renamed over
+path once it is on disk, so readers only ever see complete files.
+*/
+bool buildTable(const char *path, const int *keys, const int *data, uint32_t n,
+      uint32_t maxLoad, uint32_t hashId) {
+   struct TableHeader *header;
+   struct DataItem *slots;
+   uint64_t size = 16, fileSize;
+   uint32_t maxDist = 0, count = 0, i;
+   char tmp[4096];
+   uint8_t *map;
+   int fd, err;
+
+   if(maxLoad == 0 || maxLoad > MAX_MAX_LOAD)
+      maxLoad = DEFAULT_MAX_LOAD;
+   while(size * maxLoad < (uint64_t)n * 100)
+      size *= 2;
+
+   if(hashId >= HASH_COUNT || size > (1ull << 31) ||
+      snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+      errno = EINVAL;
+      return false;
+   }
+
+   fileSize = TABLE_ALIGN + size * sizeof(struct DataItem);
+   fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if(fd < 0)
+      return false;
+
+   // a fresh file reads as zeroes: every slot starts empty
+   if(ftruncate(fd, fileSize) < 0 ||
+      (map = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+      goto fail;
+
+   slots = (struct DataItem *)(map + TABLE_ALIGN);
+   for(i = 0; i < n; i++)
+      place(slots, size, hashFuncs[hashId], (struct DataItem){ .key = keys[i], .data = data[i] });
+
+   for(i = 0; i < size; i++) {
+      count += slots[i].dist != 0;
+      if(slots[i].dist > maxDist)
+         maxDist = slots[i].dist;
+   }
+
+   header = (struct TableHeader *)map;
+   header->magic = TABLE_MAGIC;
+   header->version = TABLE_VERSION;
+   header->slotSize = sizeof(struct DataItem);
+   header->size = size;
+   header->count = count;
+   header->maxDist = maxDist;
+   header->hash = hashId;
+   header->slots = TABLE_ALIGN;
+   header->fileSize = fileSize;
+
+   if(msync(map, fileSize, MS_SYNC) < 0) {
+      err = errno;
+      munmap(map, fileSize);
+      errno = err;
+      goto fail;
+   }
+   munmap(map, fileSize);
+
+   if(close(fd) < 0 || rename(tmp, path) < 0) {
+      err = errno;
+      unlink(tmp);
+      errno = err;
+      return false;
+   }
+   return syncDir(path);
+
+fail:
+   err = errno;
+   close(fd);
+   unlink(tmp);
+   errno = err;
+   return false;
+}
+
+/*
+Maps the file read-only and checks the header, nothing else is read:
+pages of the slot array are faulted in by the lookups that touch them.
+*/
+bool openTable(struct MappedTable *t, const char *path) {
+   const struct TableHeader *header;
+   struct stat st;
+   void *map;
+   int fd;
+
+   fd = open(path, O_RDONLY);
+   if(fd < 0)
+      return false;
+
+   if(fstat(fd, &st) < 0) {
+      close(fd);
+      return false;
+   }
+   if((uint64_t)st.st_size < sizeof(struct TableHeader)) {
+      close(fd);
+      errno = EINVAL;
+      return false;
+   }
+
+   map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if(map == MAP_FAILED)
+      return false;
+
+   // a bad header must not send a search outside the mapping
+   header = map;
+   if(header->magic != TABLE_MAGIC || header->version != TABLE_VERSION ||
+      header->slotSize != sizeof(struct DataItem) || header->fileSize != (uint64_t)st.st_size ||
+      header->size == 0 || (header->size & (header->size - 1)) || header->hash >= HASH_COUNT ||
+      header->slots % sizeof(uint32_t) || header->slots < sizeof(struct TableHeader) ||
+      header->slots > header->fileSize ||
+      header->slots + (uint64_t)header->size * sizeof(struct DataItem) > header->fileSize) {
+      munmap(map, st.st_size);
+      errno = EINVAL;
+      return false;
+   }
+
+   // lookups jump around, read-ahead would only page in neighbours nobody asked for
+   madvise(map, st.st_size, MADV_RANDOM);
+
+   t->header = header;
+   t->slots = (const struct DataItem *)((const uint8_t *)map + header->slots);
+   t->size = header->size;
+   t->maxDist = header->maxDist;
+   t->hash = hashFuncs[header->hash];
+   t->mapSize = st.st_size;
+   return true;
+}
+
+void closeTable(struct MappedTable *t) {
+   munmap((void *)t->header, t->mapSize);
+   t->header = NULL;
+   t->slots = NULL;
+}
+
+/* Valid until closeTable */
+const struct DataItem *search(const struct MappedTable *t, int key) {
+   uint32_t mask = t->size - 1;
+   uint32_t hashIndex = homeOf(t->hash, t->size, key);
+   uint32_t dist;
+
+   for(dist = 1; dist <= t->maxDist; dist++) {
+      const struct DataItem *slot = &t->slots[hashIndex];
+
+      if(slot->dist < dist)
+         return NULL;
+
+      if(slot->key == key)
+         return slot;
+
+      hashIndex = (hashIndex + 1) & mask;
+   }
+   return NULL;
+}
+
+static void check_item(const struct MappedTable *t, int key) {
+   const struct DataItem *item = search(t, key);
+
+   if(item != NULL) {
+      printf("Element found: %d\n", item->data);
+   } else {
+      printf("Element with key %d not found\n", key);
+   }
+}
+
+#define TABLE_KEYS (1 << 20)
+#define TABLE_PATH "hashTable_mmap.db"
+
+static double now(void) {
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+With a path, a valid table file there is opened as is, a warm start, and
+otherwise built and kept. Without one, a temporary table is built and removed.
+*/
+int main(int argc, char **argv) {
+   static int keys[TABLE_KEYS], data[TABLE_KEYS];
+   const char *path = argc > 1 ? argv[1] : TABLE_PATH;
+   struct MappedTable t;
+   double start, opened;
+   uint32_t i;
+
+   // what a restart does: map and go
+   start = now();
+   if(argc > 1 && openTable(&t, path)) {
+      opened = now() - start;
+      printf("opened %s in %.1f us\n", path, opened * 1e6);
+   } else {
+      for(i = 0; i < TABLE_KEYS; i++) {
+         keys[i] = i * 7;
+         data[i] = i;
+      }
+
+      start = now();
+      if(!buildTable(path, keys, data, TABLE_KEYS, DEFAULT_MAX_LOAD, HASH_FIBONACCI)) {
+         perror("buildTable");
+         exit(EXIT_FAILURE);
+      }
+      printf("built %s in %.1f ms\n", path, (now() - start) * 1e3);
+
+      start = now();
+      if(!openTable(&t, path)) {
+         perror("openTable");
+         exit(EXIT_FAILURE);
+      }
+      opened = now() - start;
+      printf("opened %s in %.1f us\n", path, opened * 1e6);
+   }
+
+   check_item(&t, 42);
+   check_item(&t, 43);
+
+   for(i = 0; i < TABLE_KEYS; i++) {
+      const struct DataItem *item = search(&t, i * 7);
+
+      if(item == NULL || item->data != (int)i || search(&t, i * 7 + 1) != NULL) {
+         printf("ERROR: key %u wrong after reopening\n", i * 7);
+         exit(EXIT_FAILURE);
+      }
+   }
+   printf("%u items in %u slots (%zu bytes), longest probe %u\n", t.header->count, t.size, t.mapSize, t.maxDist);
+
+   closeTable(&t);
+   if(argc <= 1)
+      unlink(path);
+   return 0;
+}
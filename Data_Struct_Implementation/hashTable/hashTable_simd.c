@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "hash.h"
+
+#define GROUP_SIZE 16          // slots per control group, one SSE2 register
+#define INITIAL_GROUPS 1       // power of two
+#define DEFAULT_MAX_LOAD 87    // percent, 7/8 is where a group probe still ends early
+#define MAX_MAX_LOAD 95        // as for the other tables, longer probes but every search still ends
+
+/* Control byte per slot: 7 hash bits when full, the high bit set otherwise */
+#define CTRL_EMPTY   ((int8_t)0x80)
+#define CTRL_DELETED ((int8_t)0xFE)
+
+struct DataItem {
+   int key;
+   int data;
+};
+
+struct HashTable {
+   int8_t *ctrl;               // groups * GROUP_SIZE, 16-byte aligned
+   struct DataItem *slots;
+   uint32_t groups;            // power of two
+   uint32_t count;
+   uint32_t growthLeft;        // inserts into empty slots before the next rehash
+   uint32_t maxLoad;           // percent
+};
+
+static inline uint64_t hashCode(int key) {
+   // 64-bit mixer: the low bits pick the group, the top 7 go to the control byte
+   return hashMix64((uint32_t)key);
+}
+
+static inline int8_t h2(uint64_t hash) {
+   return (int8_t)(hash >> 57);
+}
+
+/* Bit i set for every slot i of the group whose control byte matches */
+#ifdef __SSE2__
+static inline uint32_t matchByte(const int8_t *group, int8_t b) {
+   __m128i ctrl = _mm_load_si128((const __m128i *)group);
+
+   return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b)));
+}
+
+static inline uint32_t matchFree(const int8_t *group) {
+   // empty and deleted are the only control bytes with the high bit set
+   return _mm_movemask_epi8(_mm_load_si128((const __m128i *)group));
+}
+#else
+static inline uint32_t matchByte(const int8_t *group, int8_t b) {
+   uint32_t mask = 0, i;
+
+   for(i = 0; i < GROUP_SIZE; i++)
+      mask |= (uint32_t)(group[i] == b) << i;
+   return mask;
+}
+
+static inline uint32_t matchFree(const int8_t *group) {
+   uint32_t mask = 0, i;
+
+   for(i = 0; i < GROUP_SIZE; i++)
+      mask |= (uint32_t)(group[i] < 0) << i;
+   return mask;
+}
+#endif
+
+static uint32_t capacityOf(struct HashTable *ht) {
+   return ht->groups * GROUP_SIZE;
+}
+
+static bool allocTable(struct HashTable *ht, uint32_t groups) {
+   ht->ctrl = aligned_alloc(GROUP_SIZE, groups * GROUP_SIZE);
+   ht->slots = malloc(sizeof(struct DataItem) * groups * GROUP_SIZE);
+   if(ht->ctrl == NULL || ht->slots == NULL) {
+      free(ht->ctrl);
+      free(ht->slots);
+      return false;
+   }
+
+   memset(ht->ctrl, CTRL_EMPTY, groups * GROUP_SIZE);
+   ht->groups = groups;
+   ht->growthLeft = (uint64_t)groups * GROUP_SIZE * ht->maxLoad / 100;
+   return true;
+}
+
+/* maxLoad 0 or above MAX_MAX_LOAD takes DEFAULT_MAX_LOAD */
+bool initTable(struct HashTable *ht, uint32_t maxLoad) {
+   if(maxLoad == 0 || maxLoad > MAX_MAX_LOAD)
+      maxLoad = DEFAULT_MAX_LOAD;
+
+   ht->maxLoad = maxLoad;
+   ht->count = 0;
+   return allocTable(ht, INITIAL_GROUPS);
+}
+
+void freeTable(struct HashTable *ht) {
+   free(ht->ctrl);
+   free(ht->slots);
+   ht->ctrl = NULL;
+   ht->slots = NULL;
+   ht->groups = ht->count = ht->growthLeft = 0;
+}
+
+/* Valid until the next insert or delete */
+struct DataItem *search(struct HashTable *ht, int key) {
+   uint64_t hash = hashCode(key);
+   uint32_t mask = ht->groups - 1;
+   uint32_t group = hash & mask, probe = 0, match, i;
+   const int8_t *ctrl;
+
+   for(;;) {
+      ctrl = ht->ctrl + group * GROUP_SIZE;
+
+      for(match = matchByte(ctrl, h2(hash)); match; match &= match - 1) {
+         i = group * GROUP_SIZE + __builtin_ctz(match);
+         if(ht->slots[i].key == key)
+            return &ht->slots[i];
+      }
+
+      // an empty slot here means the key would have been placed no further
+      if(matchByte(ctrl, CTRL_EMPTY))
+         return NULL;
+
+      // triangular steps visit every group of a power of two table
+      group = (group + ++probe) & mask;
+   }
+}
+
+/* First empty or deleted slot along the probe sequence of hash */
+static uint32_t findFree(struct HashTable *ht, uint64_t hash) {
+   uint32_t mask = ht->groups - 1;
+   uint32_t group = hash & mask, probe = 0, match;
+
+   for(;;) {
+      match = matchFree(ht->ctrl + group * GROUP_SIZE);
+      if(match)
+         return group * GROUP_SIZE + __builtin_ctz(match);
+
+      group = (group + ++probe) & mask;
+   }
+}
+
+static bool rehash(struct HashTable *ht, uint32_t groups) {
+   struct HashTable old = *ht;
+   uint32_t i, slot;
+
+   if(!allocTable(ht, groups)) {
+      *ht = old;
+      return false;
+   }
+
+   for(i = 0; i < old.groups * GROUP_SIZE; i++) {
+      if(old.ctrl[i] >= 0) {
+         slot = findFree(ht, hashCode(old.slots[i].key));
+         ht->ctrl[slot] = old.ctrl[i];
+         ht->slots[slot] = old.slots[i];
+      }
+   }
+   // a low maxLoad can leave no room at a small size, insert doubles again
+   ht->growthLeft = ht->growthLeft > ht->count ? ht->growthLeft - ht->count : 0;
+
+   free(old.ctrl);
+   free(old.slots);
+   return true;
+}
+
+/* Adds the key or updates its data, false only when out of memory */
+bool insert(struct HashTable *ht, int key, int data) {
+   struct DataItem *item = search(ht, key);
+   uint64_t hash = hashCode(key);
+   uint32_t slot;
+
+   if(item != NULL) {
+      item->data = data;
+      return true;
+   }
+
+   slot = findFree(ht, hash);
+   while(ht->growthLeft == 0 && ht->ctrl[slot] == CTRL_EMPTY) {
+      // mostly tombstones: rehash in place, else double
+      uint32_t groups = ht->count * 2 < (uint64_t)capacityOf(ht) * ht->maxLoad / 100 ? ht->groups : ht->groups * 2;
+
+      if(!rehash(ht, groups))
+         return false;
+      slot = findFree(ht, hash);
+   }
+
+   if(ht->ctrl[slot] == CTRL_EMPTY)
+      ht->growthLeft--;
+   ht->ctrl[slot] = h2(hash);
+   ht->slots[slot].key = key;
+   ht->slots[slot].data = data;
+   ht->count++;
+   return true;
+}
+
+bool delete(struct HashTable *ht, int key) {
+   struct DataItem *item = search(ht, key);
+   uint32_t slot;
+
+   if(item == NULL)
+      return false;
+
+   slot = item - ht->slots;
+   // searches already stop at this group if it has an empty slot, otherwise leave a tombstone
+   if(matchByte(ht->ctrl + slot / GROUP_SIZE * GROUP_SIZE, CTRL_EMPTY)) {
+      ht->ctrl[slot] = CTRL_EMPTY;
+      ht->growthLeft++;
+   } else {
+      ht->ctrl[slot] = CTRL_DELETED;
+   }
+   ht->count--;
+   return true;
+}
+
+void display(struct HashTable *ht) {
+   uint32_t i = 0;
+
+   for(i = 0; i<capacityOf(ht); i++) {
+
+      if(ht->ctrl[i] >= 0)
+         printf(" (%d,%d)",ht->slots[i].key,ht->slots[i].data);
+      else
+         printf(" ~~ ");
+   }
+
+   printf("\n");
+}
+
+static void check_item(struct HashTable *ht, int key) {
+   struct DataItem *item = search(ht, key);
+
+   if(item != NULL) {
+      printf("Element found: %d\n", item->data);
+   } else {
+      printf("Element with key %d not found\n", key);
+   }
+}
+
+#define STRESS_KEYS 100000
+
+int main() {
+   struct HashTable ht;
+   int key;
+
+   if(!initTable(&ht, DEFAULT_MAX_LOAD)) {
+      printf("ERROR: table allocation failure\n");
+      exit(EXIT_FAILURE);
+   }
+
+   insert(&ht, 1, 20);
+   insert(&ht, 2, 70);
+   insert(&ht, 42, 80);
+   insert(&ht, 4, 25);
+   insert(&ht, 12, 44);
+   insert(&ht, 14, 32);
+   insert(&ht, 17, 11);
+   insert(&ht, 13, 78);
+   insert(&ht, 37, 97);
+
+   display(&ht);
+   check_item(&ht, 37);
+
+   delete(&ht, 37);
+   check_item(&ht, 37);
+   check_item(&ht, 17);
+   display(&ht);
+
+   // grow well past one group, delete half, and look up keys that were never there
+   for(key = 0; key < STRESS_KEYS; key++)
+      insert(&ht, key * 7, key);
+   for(key = 0; key < STRESS_KEYS; key += 2)
+      delete(&ht, key * 7);
+
+   for(key = 0; key < STRESS_KEYS; key++) {
+      struct DataItem *item = search(&ht, key * 7);
+
+      if((key % 2 == 0) != (item == NULL) || (item != NULL && item->data != key) ||
+         search(&ht, -key - 1) != NULL) {
+         printf("ERROR: key %d wrong after rehash/delete\n", key * 7);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   printf("%u items in %u slots (%u groups of %u)\n", ht.count, capacityOf(&ht), ht.groups, GROUP_SIZE);
+
+   freeTable(&ht);
+   return 0;
+}
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hash.h"
+
+#define INITIAL_SIZE 16        // power of two
+#define DEFAULT_MAX_LOAD 85    // percent
+#define MAX_MAX_LOAD 95
+#define HASH_SEED 0x2545f4914f6cdd1dull
+
+/*
+Robin Hood probing as in hashTable.c, with byte string keys. The slot
+keeps the key's hash next to the key pointer: a probe compares hashes
+first and only reads the key bytes (one more cache miss) when they match.
+Resizing moves items by their stored hash, no key is hashed again.
+*/
+struct DataItem {
+   char *key;          // own copy, NUL terminated for printing
+   uint32_t len;
+   uint32_t hash;
+   uint32_t dist;      // probe distance + 1, 0 when empty
+   int data;
+};
+
+struct HashTable {
+   struct DataItem *slots;
+   uint32_t size;      // power of two
+   uint32_t count;
+   uint32_t maxLoad;   // percent
+};
+
+static uint32_t hashKey(const char *key, uint32_t len) {
+   return hashBytes(key, len, HASH_SEED) >> 32;
+}
+
+static uint32_t homeOf(struct HashTable *ht, uint32_t hash) {
+   uint32_t shift = 32 - __builtin_ctz(ht->size);
+
+   return shift == 32 ? 0 : hash >> shift;
+}
+
+bool initTable(struct HashTable *ht, uint32_t maxLoad) {
+   if(maxLoad == 0 || maxLoad > MAX_MAX_LOAD)
+      maxLoad = DEFAULT_MAX_LOAD;
+
+   ht->slots = calloc(INITIAL_SIZE, sizeof(struct DataItem));
+   ht->size = INITIAL_SIZE;
+   ht->count = 0;
+   ht->maxLoad = maxLoad;
+
+   return ht->slots != NULL;
+}
+
+void freeTable(struct HashTable *ht) {
+   uint32_t i;
+
+   for(i = 0; i < ht->size; i++) {
+      if(ht->slots[i].dist)
+         free(ht->slots[i].key);
+   }
+   free(ht->slots);
+   ht->slots = NULL;
+   ht->size = ht->count = 0;
+}
+
+static struct DataItem *searchHash(struct HashTable *ht, const char *key, uint32_t len, uint32_t hash) {
+   uint32_t mask = ht->size - 1;
+   uint32_t hashIndex = homeOf(ht, hash);
+   uint32_t dist;
+
+   for(dist = 1; ; dist++) {
+      struct DataItem *slot = &ht->slots[hashIndex];
+
+      if(slot->dist < dist)
+         return NULL;
+
+      // a different hash settles it without touching the key
+      if(slot->hash == hash && slot->len == len && memcmp(slot->key, key, len) == 0)
+         return slot;
+
+      hashIndex = (hashIndex + 1) & mask;
+   }
+}
+
+/* Valid until the next insert or delete, both may move items */
+struct DataItem *search(struct HashTable *ht, const char *key, uint32_t len) {
+   return searchHash(ht, key, len, hashKey(key, len));
+}
+
+static void place(struct HashTable *ht, struct DataItem item) {
+   uint32_t mask = ht->size - 1;
+   uint32_t hashIndex = homeOf(ht, item.hash);
+   struct DataItem tmp;
+
+   for(item.dist = 1; ; item.dist++) {
+      struct DataItem *slot = &ht->slots[hashIndex];
+
+      if(slot->dist == 0) {
+         *slot = item;
+         return;
+      }
+
+      if(slot->dist < item.dist) {
+         tmp = *slot;
+         *slot = item;
+         item = tmp;
+      }
+
+      hashIndex = (hashIndex + 1) & mask;
+   }
+}
+
+static bool resize(struct HashTable *ht, uint32_t size) {
+   struct DataItem *old = ht->slots;
+   uint32_t oldSize = ht->size, i;
+
+   ht->slots = calloc(size, sizeof(struct DataItem));
+   if(ht->slots == NULL) {
+      ht->slots = old;
+      return false;
+   }
+   ht->size = size;
+
+   for(i = 0; i < oldSize; i++) {
+      if(old[i].dist)
+         place(ht, old[i]);
+   }
+
+   free(old);
+   return true;
+}
+
+/* Adds a copy of the key or updates its data, false only when out of memory */
+bool insert(struct HashTable *ht, const char *key, uint32_t len, int data) {
+   uint32_t hash = hashKey(key, len);
+   struct DataItem *item = searchHash(ht, key, len, hash);
+   char *copy;
+
+   if(item != NULL) {
+      item->data = data;
+      return true;
+   }
+
+   if((uint64_t)(ht->count + 1) * 100 > (uint64_t)ht->size * ht->maxLoad) {
+      if(!resize(ht, ht->size * 2))
+         return false;
+   }
+
+   copy = malloc(len + 1);
+   if(copy == NULL)
+      return false;
+   memcpy(copy, key, len);
+   copy[len] = '\0';
+
+   place(ht, (struct DataItem){ .key = copy, .len = len, .hash = hash, .data = data });
+   ht->count++;
+   return true;
+}
+
+bool delete(struct HashTable *ht, const char *key, uint32_t len) {
+   uint32_t mask = ht->size - 1;
+   struct DataItem *item = search(ht, key, len);
+   uint32_t hashIndex, next;
+
+   if(item == NULL)
+      return false;
+
+   free(item->key);
+   hashIndex = item - ht->slots;
+   for(;;) {
+      next = (hashIndex + 1) & mask;
+
+      if(ht->slots[next].dist <= 1)
+         break;
+
+      ht->slots[hashIndex] = ht->slots[next];
+      ht->slots[hashIndex].dist--;
+      hashIndex = next;
+   }
+
+   ht->slots[hashIndex].dist = 0;
+   ht->count--;
+   return true;
+}
+
+void display(struct HashTable *ht) {
+   uint32_t i = 0;
+
+   for(i = 0; i<ht->size; i++) {
+
+      if(ht->slots[i].dist)
+         printf(" (%s,%d)",ht->slots[i].key,ht->slots[i].data);
+      else
+         printf(" ~~ ");
+   }
+
+   printf("\n");
+}
+
+static void check_item(struct HashTable *ht, const char *key) {
+   struct DataItem *item = search(ht, key, strlen(key));
+
+   if(item != NULL) {
+      printf("Element found: %d\n", item->data);
+   } else {
+      printf("Element with key %s not found\n", key);
+   }
+}
+
+#define STRESS_KEYS 100000
+
+int main() {
+   struct HashTable ht;
+   uint32_t maxDist = 0, i;
+   char name[64];
+   int key, len;
+
+   if(!initTable(&ht, DEFAULT_MAX_LOAD)) {
+      printf("ERROR: table allocation failure\n");
+      exit(EXIT_FAILURE);
+   }
+
+   insert(&ht, "uart0", 5, 20);
+   insert(&ht, "uart1", 5, 70);
+   insert(&ht, "spi0", 4, 80);
+   insert(&ht, "i2c0", 4, 25);
+   insert(&ht, "gpio", 4, 44);
+   insert(&ht, "timer0", 6, 32);
+   insert(&ht, "watchdog", 8, 11);
+
+   display(&ht);
+   check_item(&ht, "spi0");
+
+   delete(&ht, "spi0", 4);
+   check_item(&ht, "spi0");
+   check_item(&ht, "watchdog");
+   display(&ht);
+
+   // long names that only differ near the end, then delete half
+   for(key = 0; key < STRESS_KEYS; key++) {
+      len = snprintf(name, sizeof(name), "soc/peripheral-bus/module-%d/register-%d", key / 64, key % 64);
+      insert(&ht, name, len, key);
+   }
+   for(key = 0; key < STRESS_KEYS; key += 2) {
+      len = snprintf(name, sizeof(name), "soc/peripheral-bus/module-%d/register-%d", key / 64, key % 64);
+      delete(&ht, name, len);
+   }
+
+   for(key = 0; key < STRESS_KEYS; key++) {
+      struct DataItem *item;
+
+      len = snprintf(name, sizeof(name), "soc/peripheral-bus/module-%d/register-%d", key / 64, key % 64);
+      item = search(&ht, name, len);
+      // a longer key with the same prefix is a different key, name is no longer terminated
+      name[len] = 'x';
+      if((key % 2 == 0) != (item == NULL) || (item != NULL && item->data != key) ||
+         search(&ht, name, len + 1) != NULL) {
+         printf("ERROR: key %.*s wrong after resize/delete\n", len, name);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   for(i = 0; i < ht.size; i++) {
+      if(ht.slots[i].dist > maxDist)
+         maxDist = ht.slots[i].dist;
+   }
+   printf("%u items in %u slots, longest probe %u\n", ht.count, ht.size, maxDist);
+
+   freeTable(&ht);
+   return 0;
+}
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "hash.h"
+
+#define BUCKET_KEYS 4              // average keys per bucket, CHD's lambda
+#define MAX_DISPLACE (1u << 24)    // displacements tried per bucket before a new seed
+#define MAX_SEEDS 64
+#define GOLDEN 0x9e3779b9u
+
+/*
+Minimal perfect hashing by hash and displace (CHD): the keys are hashed
+into n / BUCKET_KEYS buckets, and each bucket, biggest first, gets the
+first displacement that sends all its keys to slots no earlier bucket
+took. A lookup is one hash, the bucket's displacement and the slot.
+*/
+struct Entry {
+   int key;
+   int value;
+};
+
+struct Builder {
+   struct Entry *entries;
+   uint32_t n;
+   uint32_t buckets;
+   uint64_t seed;
+   uint32_t *displace;     // per bucket
+   uint32_t *slotOf;       // per entry
+};
+
+/* The formulas the generated lookup repeats */
+static inline uint32_t bucketOf(uint64_t h, uint32_t buckets) {
+   return ((h >> 32) * buckets) >> 32;
+}
+
+static inline uint32_t slotFor(uint64_t h, uint32_t d, uint32_t n) {
+   return ((uint64_t)hashMix32((uint32_t)h ^ d * GOLDEN) * n) >> 32;
+}
+
+static int compareKeys(const void *a, const void *b) {
+   const struct Entry *x = a, *y = b;
+
+   return (x->key > y->key) - (x->key < y->key);
+}
+
+/* Bucket order for placing: biggest first */
+static const uint32_t *sortSizes;
+
+static int compareBuckets(const void *a, const void *b) {
+   uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+   if(sortSizes[x] != sortSizes[y])
+      return sortSizes[x] < sortSizes[y] ? 1 : -1;
+   return (x > y) - (x < y);
+}
+
+/* One attempt with b->seed, false if some bucket found no displacement */
+static bool place(struct Builder *b) {
+   uint32_t *size = calloc(b->buckets + 1, sizeof(uint32_t));
+   uint32_t *first = calloc(b->buckets + 1, sizeof(uint32_t));
+   uint32_t *members = malloc(b->n * sizeof(uint32_t));
+   uint32_t *order = malloc(b->buckets * sizeof(uint32_t));
+   uint64_t *hash = malloc(b->n * sizeof(uint64_t));
+   bool *taken = calloc(b->n, sizeof(bool));
+   uint32_t i, j, k, bucket, d, slot;
+   bool ok = false;
+
+   if(!size || !first || !members || !order || !hash || !taken) {
+      fprintf(stderr, "perfectHash: out of memory\n");
+      exit(EXIT_FAILURE);
+   }
+
+   // counting sort of the entries by bucket
+   for(i = 0; i < b->n; i++) {
+      hash[i] = hashMix64((uint32_t)b->entries[i].key ^ b->seed);
+      size[bucketOf(hash[i], b->buckets)]++;
+   }
+   for(i = 0; i < b->buckets; i++)
+      first[i + 1] = first[i] + size[i];
+   for(i = 0; i < b->n; i++) {
+      bucket = bucketOf(hash[i], b->buckets);
+      members[first[bucket]++] = i;
+   }
+   for(i = 0; i < b->buckets; i++)
+      first[i] -= size[i];
+
+   for(i = 0; i < b->buckets; i++)
+      order[i] = i;
+   sortSizes = size;
+   qsort(order, b->buckets, sizeof(uint32_t), compareBuckets);
+
+   for(i = 0; i < b->buckets; i++) {
+      bucket = order[i];
+      b->displace[bucket] = 0;
+
+      for(d = 0; d < MAX_DISPLACE && size[bucket]; d++) {
+         // take the slots one by one, give them back on the first clash
+         for(j = 0; j < size[bucket]; j++) {
+            slot = slotFor(hash[members[first[bucket] + j]], d, b->n);
+            if(taken[slot])
+               break;
+            taken[slot] = true;
+            b->slotOf[members[first[bucket] + j]] = slot;
+         }
+
+         if(j == size[bucket])
+            break;
+
+         for(k = 0; k < j; k++)
+            taken[b->slotOf[members[first[bucket] + k]]] = false;
+      }
+
+      if(d == MAX_DISPLACE)
+         goto out;
+      b->displace[bucket] = d;
+   }
+   ok = true;
+
+out:
+   free(size);
+   free(first);
+   free(members);
+   free(order);
+   free(hash);
+   free(taken);
+   return ok;
+}
+
+/* "key value" per line, decimal or 0x hex, # starts a comment */
+static struct Entry *readKeys(FILE *in, const char *name, uint32_t *n) {
+   struct Entry *entries = NULL, *grown;
+   uint32_t count = 0, capacity = 0, line = 0;
+   char buf[256], *p, *end;
+   long key, value;
+
+   while(fgets(buf, sizeof(buf), in)) {
+      line++;
+      if((p = strchr(buf, '#')))
+         *p = '\0';
+      for(p = buf; isspace((unsigned char)*p); p++)
+         ;
+      if(*p == '\0')
+         continue;
+
+      key = strtol(p, &end, 0);
+      if(end == p)
+         goto bad;
+      p = end;
+      value = strtol(p, &end, 0);
+      if(end == p)
+         goto bad;
+      for(p = end; isspace((unsigned char)*p); p++)
+         ;
+      if(*p || key < INT32_MIN || key > UINT32_MAX || value < INT32_MIN || value > INT32_MAX)
+         goto bad;
+
+      if(count == capacity) {
+         capacity = capacity ? capacity * 2 : 64;
+         grown = realloc(entries, capacity * sizeof(struct Entry));
+         if(!grown) {
+            fprintf(stderr, "perfectHash: out of memory\n");
+            exit(EXIT_FAILURE);
+         }
+         entries = grown;
+      }
+      // keys up to 0xffffffff are register addresses, keep their bits
+      entries[count].key = (int)(uint32_t)key;
+      entries[count].value = (int)value;
+      count++;
+   }
+
+   *n = count;
+   return entries;
+
+bad:
+   fprintf(stderr, "%s:%u: expected \"key value\"\n", name, line);
+   exit(EXIT_FAILURE);
+}
+
+static void emit(FILE *out, struct Builder *b, const char *prefix, const char *source) {
+   struct Entry *table = malloc(b->n * sizeof(struct Entry));
+   uint32_t maxDisplace = 0, i;
+   const char *type;
+   char upper[256];
+
+   if(!table) {
+      fprintf(stderr, "perfectHash: out of memory\n");
+      exit(EXIT_FAILURE);
+   }
+   for(i = 0; i < b->n; i++)
+      table[b->slotOf[i]] = b->entries[i];
+   for(i = 0; i < b->buckets; i++) {
+      if(b->displace[i] > maxDisplace)
+         maxDisplace = b->displace[i];
+   }
+   for(i = 0; prefix[i] && i < sizeof(upper) - 1; i++)
+      upper[i] = toupper((unsigned char)prefix[i]);
+   upper[i] = '\0';
+
+   type = maxDisplace <= UINT8_MAX ? "uint8_t" : maxDisplace <= UINT16_MAX ? "uint16_t" : "uint32_t";
+
+   fprintf(out, "/* Generated by perfectHash from %s, do not edit */\n", source);
+   fprintf(out, "#include <stdint.h>\n#include <stdbool.h>\n\n");
+   fprintf(out, "#define %s_COUNT %uu\n#define %s_BUCKETS %uu\n\n", upper, b->n, upper, b->buckets);
+
+   fprintf(out, "struct %sEntry {\n   int key;\n   int value;\n};\n\n", prefix);
+
+   fprintf(out, "static const %s %sDisplace[%s_BUCKETS] = {", type, prefix, upper);
+   for(i = 0; i < b->buckets; i++)
+      fprintf(out, "%s%u,", i % 16 ? " " : "\n   ", b->displace[i]);
+   fprintf(out, "\n};\n\n");
+
+   fprintf(out, "const struct %sEntry %sTable[%s_COUNT] = {", prefix, prefix, upper);
+   for(i = 0; i < b->n; i++)
+      fprintf(out, "%s{ %d, %d },", i % 4 ? " " : "\n   ", table[i].key, table[i].value);
+   fprintf(out, "\n};\n\n");
+
+   fprintf(out,
+      "static inline uint32_t %sMix32(uint32_t key) {\n"
+      "   key ^= key >> 16;\n"
+      "   key *= 0x85ebca6bu;\n"
+      "   key ^= key >> 13;\n"
+      "   key *= 0xc2b2ae35u;\n"
+      "   key ^= key >> 16;\n"
+      "   return key;\n"
+      "}\n\n", prefix);
+   fprintf(out,
+      "static inline uint64_t %sMix64(uint64_t key) {\n"
+      "   key ^= key >> 33;\n"
+      "   key *= 0xff51afd7ed558ccdull;\n"
+      "   key ^= key >> 33;\n"
+      "   key *= 0xc4ceb9fe1a85ec53ull;\n"
+      "   key ^= key >> 33;\n"
+      "   return key;\n"
+      "}\n\n", prefix);
+
+   fprintf(out,
+      "/* One hash, the bucket's displacement and the slot: no probing, no collisions */\n"
+      "bool %sLookup(int key, int *value) {\n"
+      "   uint64_t h = %sMix64((uint32_t)key ^ 0x%016llxull);\n"
+      "   uint32_t d = %sDisplace[((h >> 32) * %s_BUCKETS) >> 32];\n"
+      "   const struct %sEntry *e = &%sTable[((uint64_t)%sMix32((uint32_t)h ^ d * 0x%xu) * %s_COUNT) >> 32];\n"
+      "\n"
+      "   if(e->key != key)\n"
+      "      return false;\n"
+      "   *value = e->value;\n"
+      "   return true;\n"
+      "}\n",
+      prefix, prefix, (unsigned long long)b->seed, prefix, upper, prefix, prefix, prefix, GOLDEN, upper);
+
+   free(table);
+}
+
+static void usage(void) {
+   fprintf(stderr, "usage: perfectHash [-p prefix] [-o out.c] [keys.txt]\n");
+   exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+   const char *prefix = "perfect", *outName = NULL, *inName = "<stdin>";
+   FILE *in = stdin, *out = stdout;
+   struct Builder b;
+   uint32_t i, seed;
+   int opt;
+
+   while((opt = getopt(argc, argv, "p:o:")) != -1) {
+      switch(opt) {
+      case 'p':
+         prefix = optarg;
+         break;
+      case 'o':
+         outName = optarg;
+         break;
+      default:
+         usage();
+      }
+   }
+   if(optind + 1 < argc)
+      usage();
+
+   if(optind < argc) {
+      inName = argv[optind];
+      in = fopen(inName, "r");
+      if(!in) {
+         perror(inName);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   b.entries = readKeys(in, inName, &b.n);
+   if(in != stdin)
+      fclose(in);
+   if(b.n == 0) {
+      fprintf(stderr, "%s: no keys\n", inName);
+      exit(EXIT_FAILURE);
+   }
+
+   qsort(b.entries, b.n, sizeof(struct Entry), compareKeys);
+   for(i = 1; i < b.n; i++) {
+      if(b.entries[i].key == b.entries[i - 1].key) {
+         fprintf(stderr, "%s: duplicate key %d\n", inName, b.entries[i].key);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   b.buckets = (b.n + BUCKET_KEYS - 1) / BUCKET_KEYS;
+   b.displace = malloc(b.buckets * sizeof(uint32_t));
+   b.slotOf = malloc(b.n * sizeof(uint32_t));
+   if(!b.displace || !b.slotOf) {
+      fprintf(stderr, "perfectHash: out of memory\n");
+      exit(EXIT_FAILURE);
+   }
+
+   for(seed = 0; seed < MAX_SEEDS; seed++) {
+      b.seed = hashMix64(seed + 1);
+      if(place(&b))
+         break;
+   }
+   if(seed == MAX_SEEDS) {
+      fprintf(stderr, "%s: no perfect hash found\n", inName);
+      exit(EXIT_FAILURE);
+   }
+
+   if(outName) {
+      out = fopen(outName, "w");
+      if(!out) {
+         perror(outName);
+         exit(EXIT_FAILURE);
+      }
+   }
+   emit(out, &b, prefix, inName);
+   if(out != stdout && fclose(out)) {
+      perror(outName);
+      exit(EXIT_FAILURE);
+   }
+
+   fprintf(stderr, "%u keys in %u buckets, seed %u\n", b.n, b.buckets, seed);
+   free(b.entries);
+   free(b.displace);
+   free(b.slotOf);
+   return 0;
+}
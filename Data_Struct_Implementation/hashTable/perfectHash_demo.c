@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// generated from commands.txt by perfectHash, see the Makefile
+#include "commands_hash.c"
+
+static void check_item(int key) {
+   int value;
+
+   if(commandsLookup(key, &value)) {
+      printf("Command 0x%x handled by %d\n", key, value);
+   } else {
+      printf("Command 0x%x unknown\n", key);
+   }
+}
+
+static bool inTable(int key) {
+   uint32_t i;
+
+   for(i = 0; i < COMMANDS_COUNT; i++) {
+      if(commandsTable[i].key == key)
+         return true;
+   }
+   return false;
+}
+
+int main() {
+   uint32_t i;
+   int key, value;
+
+   check_item(0x207);
+   check_item(0x7ff);
+   check_item(0x208 + 0x1000);
+
+   // every key finds its own value
+   for(i = 0; i < COMMANDS_COUNT; i++) {
+      if(!commandsLookup(commandsTable[i].key, &value) || value != commandsTable[i].value) {
+         printf("ERROR: key 0x%x lost\n", commandsTable[i].key);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   // and no other key is found
+   for(key = -0x10000; key < 0x10000; key++) {
+      if(commandsLookup(key, &value) != inTable(key)) {
+         printf("ERROR: key 0x%x wrongly found\n", key);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   printf("%u commands in %u buckets, %zu bytes of tables\n", COMMANDS_COUNT, COMMANDS_BUCKETS,
+         sizeof(commandsDisplace) + sizeof(commandsTable));
+   return 0;
+}
@@ -0,0 +1,98 @@
+#include <stdlib.h>
+
+#include "arena.h"
+
+void arenaInitialize(arena *a, size_t chunkSize)
+{
+	a->head = NULL;
+	a->current = NULL;
+	a->ptr = NULL;
+	a->chunkSize = chunkSize;
+}
+
+void arenaFreeArena(arena *a)
+{
+	arenaChunk *c, *next;
+
+	for(c = a->head; c != NULL; c = next) {
+		next = c->next;
+		free(c);
+	}
+
+	arenaInitialize(a, a->chunkSize);
+}
+
+static inline uint8_t *alignUp(uint8_t *ptr, size_t align)
+{
+	return (uint8_t *)(((uintptr_t)ptr + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+/* Slow path: move on to the next chunk that fits, or chain a new one after current */
+static void *arenaGrow(arena *a, size_t size, size_t align)
+{
+	arenaChunk *c = a->current == NULL ? a->head : a->current->next;
+	uint8_t *p;
+	size_t bytes;
+
+	// spare chunks left over from a reset, skipped only if too small for this request
+	for(; c != NULL; c = c->next) {
+		p = alignUp(c->data, align);
+		if(p <= c->end && size <= (size_t)(c->end - p)) {
+			a->current = c;
+			a->ptr = p + size;
+			return p;
+		}
+	}
+
+	bytes = a->chunkSize;
+	if(bytes < size + align)
+		bytes = size + align;
+
+	c = malloc(sizeof(arenaChunk) + bytes);
+	if(c == NULL)
+		return NULL;
+	c->end = c->data + bytes;
+
+	if(a->current == NULL) {
+		c->next = a->head;
+		a->head = c;
+	} else {
+		c->next = a->current->next;
+		a->current->next = c;
+	}
+
+	p = alignUp(c->data, align);
+	a->current = c;
+	a->ptr = p + size;
+	return p;
+}
+
+void *arenaMalloc(arena *a, size_t size, size_t align)
+{
+	uint8_t *p = alignUp(a->ptr, align);
+
+	if(a->current == NULL || p > a->current->end || size > (size_t)(a->current->end - p))
+		return arenaGrow(a, size, align);
+
+	a->ptr = p + size;
+	return p;
+}
+
+arenaMarker arenaMark(arena *a)
+{
+	arenaMarker mark = { a->current, a->ptr };
+
+	return mark;
+}
+
+void arenaRewind(arena *a, arenaMarker mark)
+{
+	a->current = mark.chunk;
+	a->ptr = mark.ptr;
+}
+
+void arenaReset(arena *a)
+{
+	a->current = NULL;
+	a->ptr = NULL;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ARENA_ALIGN 16 // alignment of the chunks themselves, and a good default per call
+
+typedef struct arenaChunk{
+	struct arenaChunk *next;
+	uint8_t *end;
+	_Alignas(ARENA_ALIGN) uint8_t data[];
+} arenaChunk;
+
+/*
+Bump-pointer allocator for objects that die together. Chunks stay
+chained after a reset or rewind and are refilled in order, so a steady
+state workload stops calling malloc altogether.
+*/
+typedef struct {
+	arenaChunk *head;
+	arenaChunk *current;
+	uint8_t *ptr; // next free byte in current
+	size_t chunkSize;
+} arena;
+
+/*
+Checkpoint: everything allocated after it goes away with arenaRewind().
+Marks nest like scopes: rewinding to a mark invalidates the marks taken
+after it, and arenaReset() invalidates them all. A mark of a fresh or
+reset arena rewinds to the start, like arenaReset().
+*/
+typedef struct {
+	arenaChunk *chunk;
+	uint8_t *ptr;
+} arenaMarker;
+
+void arenaInitialize(arena *a, size_t chunkSize);
+void arenaFreeArena(arena *a);
+/* align is a power of two */
+void *arenaMalloc(arena *a, size_t size, size_t align);
+arenaMarker arenaMark(arena *a);
+void arenaRewind(arena *a, arenaMarker mark);
+void arenaReset(arena *a);
@@ -1,5 +1,8 @@
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
 #include "pool.h"
 
@@ -7,20 +10,245 @@
 #define max(a,b) ((a)<(b)?(b):(a))
 #endif
 
+/* Allocator for the pool's own bookkeeping */
+#ifdef POOL_SYS_LIBC
+// pool.c is behind malloc itself (slab_preload.c), go straight to glibc
+extern void *__libc_malloc(size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+#define POOL_SYS_MALLOC __libc_malloc
+#define POOL_SYS_REALLOC __libc_realloc
+#define POOL_SYS_FREE __libc_free
+#else
+#define POOL_SYS_MALLOC malloc
+#define POOL_SYS_REALLOC realloc
+#define POOL_SYS_FREE free
+#endif
+
+static void *poolSysBlockAlloc(void *ctx, size_t size)
+{
+	(void)ctx;
+	return POOL_SYS_MALLOC(size);
+}
+
+static void poolSysBlockFree(void *ctx, void *block, size_t size)
+{
+	(void)ctx;
+	(void)size;
+	POOL_SYS_FREE(block);
+}
+
+/* mbind(2) without libnuma */
+#define POOL_MPOL_PREFERRED 1
+#define POOL_HUGE_PAGE (2u << 20)
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+static size_t poolMmapLength(uintptr_t flags, size_t size)
+{
+	size_t page = (flags & (POOL_MMAP_HUGE | POOL_MMAP_HUGETLB)) ? POOL_HUGE_PAGE : (size_t)sysconf(_SC_PAGESIZE);
+
+	return (size + page - 1) & ~(page - 1);
+}
+
+/* Transparent hugepages need a 2 MB aligned range: over-map and trim */
+static void *poolMmapHugeAligned(size_t length)
+{
+	uint8_t *raw, *block;
+	size_t lead;
+
+	raw = mmap(NULL, length + POOL_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(raw == MAP_FAILED)
+		return NULL;
+
+	block = (uint8_t *)(((uintptr_t)raw + POOL_HUGE_PAGE - 1) & ~(uintptr_t)(POOL_HUGE_PAGE - 1));
+	lead = block - raw;
+	if(lead)
+		munmap(raw, lead);
+	munmap(block + length, POOL_HUGE_PAGE - lead);
+
+	madvise(block, length, MADV_HUGEPAGE);
+	return block;
+}
+
+/* Prefer the node of the calling thread; before the first touch, so every page lands there */
+static void poolBindLocal(void *block, size_t length)
+{
+	unsigned cpu, node;
+	unsigned long mask[4] = { 0 };
+
+	if(syscall(SYS_getcpu, &cpu, &node, NULL) != 0 || node >= sizeof(mask) * 8)
+		return;
+
+	mask[node / (sizeof(unsigned long) * 8)] = 1ul << (node % (sizeof(unsigned long) * 8));
+	// best effort, e.g. ENOSYS on kernels without NUMA
+	syscall(SYS_mbind, block, length, POOL_MPOL_PREFERRED, mask, sizeof(mask) * 8, 0);
+}
+
+static void *poolMmapBlockAlloc(void *ctx, size_t size)
+{
+	uintptr_t flags = (uintptr_t)ctx;
+	size_t length = poolMmapLength(flags, size);
+	void *block = MAP_FAILED;
+
+	// explicit hugepages only exist if reserved (vm.nr_hugepages), else fall back to THP
+	if(flags & POOL_MMAP_HUGETLB)
+		block = mmap(NULL, length, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+
+	if(block == MAP_FAILED) {
+		if(flags & (POOL_MMAP_HUGE | POOL_MMAP_HUGETLB))
+			block = poolMmapHugeAligned(length);
+		else
+			block = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(block == MAP_FAILED || block == NULL)
+			return NULL;
+	}
+
+	if(flags & POOL_MMAP_NUMA_LOCAL)
+		poolBindLocal(block, length);
+
+	return block;
+}
+
+static void poolMmapBlockFree(void *ctx, void *block, size_t size)
+{
+	munmap(block, poolMmapLength((uintptr_t)ctx, size));
+}
+
+static void poolMmapBlockTrim(void *ctx, void *block, size_t size)
+{
+	// the pages read back as zero on the next touch
+	madvise(block, poolMmapLength((uintptr_t)ctx, size), MADV_DONTNEED);
+}
+
+#ifdef POOL_STATS
+#include <time.h>
+
+static uint64_t poolStatsNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Space-saving count of sampled call sites: an unseen site takes over the least sampled slot */
+static void poolStatsSample(pool *p, const void *site, uint64_t samples)
+{
+	poolStatsSite *s, *least = &p->stats.sites[0];
+
+	for(s = p->stats.sites; s < p->stats.sites + POOL_STATS_SITES; ++s) {
+		if(s->site == site) {
+			s->samples += samples;
+			return;
+		}
+		if(s->samples < least->samples)
+			least = s;
+	}
+
+	least->site = site;
+	least->samples += samples;
+}
+
+static void poolStatsAlloc(pool *p, uint32_t n, const void *site)
+{
+	uint64_t before = p->stats.allocs;
+
+	p->stats.allocs += n;
+	p->stats.live += n;
+	if(p->stats.live > p->stats.peakLive)
+		p->stats.peakLive = p->stats.live;
+
+	if(before / POOL_STATS_SAMPLE != p->stats.allocs / POOL_STATS_SAMPLE)
+		poolStatsSample(p, site, p->stats.allocs / POOL_STATS_SAMPLE - before / POOL_STATS_SAMPLE);
+}
+
+void poolStatsDump(pool *p, FILE *out)
+{
+	uint64_t now = poolStatsNow();
+	double seconds = (now - p->stats.lastNs) / 1e9;
+	uint32_t i;
+
+	fprintf(out, "pool %p: elementSize %u blockSize %u\n", (void *)p, p->elementSize, p->blockSize);
+	fprintf(out, "  live %u (peak %u), blocks %u, free list %u\n",
+			p->stats.live, p->stats.peakLive, p->stats.blocks, p->freeCount);
+	fprintf(out, "  allocs %llu frees %llu, %.0f allocs/s since last dump\n",
+			(unsigned long long)p->stats.allocs, (unsigned long long)p->stats.frees,
+			seconds > 0 ? (p->stats.allocs - p->stats.lastAllocs) / seconds : 0.0);
+
+	// addresses resolve with addr2line -f -e <binary>
+	fprintf(out, "  call sites, 1 in %u allocations sampled:\n", POOL_STATS_SAMPLE);
+	for(i = 0; i < POOL_STATS_SITES; ++i) {
+		if(p->stats.sites[i].samples)
+			fprintf(out, "    %p %llu\n", p->stats.sites[i].site,
+					(unsigned long long)p->stats.sites[i].samples);
+	}
+
+	p->stats.lastAllocs = p->stats.allocs;
+	p->stats.lastNs = now;
+}
+
+#define POOL_STATS_ALLOC(p, n, site) poolStatsAlloc((p), (n), (site))
+#define POOL_STATS_FREE(p, n) ((p)->stats.frees += (n), (p)->stats.live -= (n))
+#define POOL_STATS_BLOCKS(p, n) ((p)->stats.blocks += (n))
+#else
+#define POOL_STATS_ALLOC(p, n, site) ((void)(site))
+#define POOL_STATS_FREE(p, n) ((void)0)
+#define POOL_STATS_BLOCKS(p, n) ((void)0)
+#endif
+
 void poolInitialize(pool *p, const uint32_t elementSize, const uint32_t blockSize)
 {
 	uint32_t i;
 
 	p->elementSize = max(elementSize, sizeof(poolFreed));
 	p->blockSize = blockSize;
+	p->highWater = 0;
+#ifdef POOL_STATS
+	memset(&p->stats, 0, sizeof(p->stats));
+	p->stats.lastNs = poolStatsNow();
+#endif
 	
 	poolFreeAll(p);
 
 	p->blocksUsed = POOL_BLOCKS_INITIAL;
-	p->blocks = malloc(sizeof(uint8_t*)* p->blocksUsed);
+	p->blocks = POOL_SYS_MALLOC(sizeof(uint8_t*)* p->blocksUsed);
 
 	for(i = 0; i < p->blocksUsed; ++i)
 		p->blocks[i] = NULL;
+
+	p->backing.blockAlloc = poolSysBlockAlloc;
+	p->backing.blockFree = poolSysBlockFree;
+	p->backing.blockTrim = NULL;
+	p->backing.ctx = NULL;
+}
+
+void poolSetBacking(pool *p, const poolBacking *backing)
+{
+	p->backing = *backing;
+}
+
+void poolSetMmapBacking(pool *p, uint32_t flags)
+{
+	poolBacking backing = {
+		.blockAlloc = poolMmapBlockAlloc,
+		.blockFree = poolMmapBlockFree,
+		.blockTrim = (flags & POOL_MMAP_DONTNEED) ? poolMmapBlockTrim : NULL,
+		.ctx = (void *)(uintptr_t)flags,
+	};
+
+	// blocks start page aligned, so a whole number of lines per element aligns them all
+	if(flags & POOL_MMAP_CACHELINE)
+		p->elementSize = (p->elementSize + POOL_CACHE_LINE - 1) & ~(uint32_t)(POOL_CACHE_LINE - 1);
+
+	// fill the hugepages the block is rounded up to anyway
+	if(flags & (POOL_MMAP_HUGE | POOL_MMAP_HUGETLB))
+		p->blockSize = poolMmapLength(flags, (size_t)p->elementSize * p->blockSize) / p->elementSize;
+
+	poolFreeAll(p); // used depends on blockSize
+	poolSetBacking(p, &backing);
 }
 
 void poolFreePool(pool *p)
@@ -30,18 +258,20 @@ void poolFreePool(pool *p)
 		if(p->blocks[i] == NULL)
 			break;
 		else
-			free(p->blocks[i]);
+			p->backing.blockFree(p->backing.ctx, p->blocks[i], (size_t)p->elementSize * p->blockSize);
 	}
 
-	free(p->blocks);
+	POOL_SYS_FREE(p->blocks);
 }
 
 #ifndef DISABLE_MEMORY_POOLING
-void *poolMalloc(pool *p)
+void *poolMallocFrom(pool *p, const void *site)
 {
 	if(p->freed != NULL) {
 		void *recycle = p->freed;
 		p->freed = p->freed->nextFree;
+		--p->freeCount;
+		POOL_STATS_ALLOC(p, 1, site);
 		return recycle;
 	}
 
@@ -51,31 +281,319 @@ void *poolMalloc(pool *p)
 			uint32_t i;
 
 			p->blocksUsed <<= 1;
-			p->blocks = realloc(p->blocks, sizeof(uint8_t*)* p->blocksUsed);
+			p->blocks = POOL_SYS_REALLOC(p->blocks, sizeof(uint8_t*)* p->blocksUsed);
 
 			for(i = p->blocksUsed >> 1; i < p->blocksUsed; ++i)
 				p->blocks[i] = NULL;
 		}
 
-		if(p->blocks[p->block] == NULL)
-			p->blocks[p->block] = malloc(p->elementSize * p->blockSize);
+		if(p->blocks[p->block] == NULL) {
+			p->blocks[p->block] = p->backing.blockAlloc(p->backing.ctx, (size_t)p->elementSize * p->blockSize);
+			if(p->blocks[p->block] == NULL) {
+				// step back so the next call retries this block
+				--p->block;
+				p->used = p->blockSize - 1;
+				return NULL;
+			}
+			POOL_STATS_BLOCKS(p, 1);
+		}
 	}
+
+	POOL_STATS_ALLOC(p, 1, site);
 	
 	return p->blocks[p->block] + p->used * p->elementSize;
 }
 
+void *poolMalloc(pool *p)
+{
+	return poolMallocFrom(p, __builtin_return_address(0));
+}
+
 void poolFree(pool *p, void *ptr)
 {
 	poolFreed *pFreed = p->freed;
 
 	p->freed = ptr;
 	p->freed->nextFree = pFreed;
+	POOL_STATS_FREE(p, 1);
+	++p->freeCount;
+}
+
+uint32_t poolMallocBatchFrom(pool *p, void **out, uint32_t n, const void *site)
+{
+	poolFreed *f = p->freed;
+	uint32_t i = 0, run;
+	uint8_t *next;
+
+	// take a chain off the free list, one head update at the end
+	while(i < n && f != NULL) {
+		out[i++] = f;
+		f = f->nextFree;
+	}
+	p->freed = f;
+	p->freeCount -= i;
+	POOL_STATS_ALLOC(p, i, site);
+
+	while(i < n) {
+		// current block exhausted: poolMallocFrom moves to the next one
+		if(p->used == p->blockSize - 1) {
+			if((out[i] = poolMallocFrom(p, site)) == NULL)
+				break;
+			++i;
+			continue;
+		}
+
+		// carve a contiguous run out of the current block
+		run = p->blockSize - 1 - p->used;
+		if(run > n - i)
+			run = n - i;
+
+		next = p->blocks[p->block] + (p->used + 1) * p->elementSize;
+		p->used += run;
+		POOL_STATS_ALLOC(p, run, site);
+		while(run--) {
+			out[i++] = next;
+			next += p->elementSize;
+		}
+	}
+
+	return i;
+}
+
+uint32_t poolMallocBatch(pool *p, void **out, uint32_t n)
+{
+	return poolMallocBatchFrom(p, out, n, __builtin_return_address(0));
+}
+
+void poolFreeBatch(pool *p, void **ptrs, uint32_t n)
+{
+	uint32_t i;
+
+	if(n == 0)
+		return;
+
+	// link the chain, then splice it in front of the free list
+	for(i = 0; i < n - 1; ++i)
+		((poolFreed *)ptrs[i])->nextFree = ptrs[i + 1];
+	((poolFreed *)ptrs[n - 1])->nextFree = p->freed;
+	p->freed = ptrs[0];
+	POOL_STATS_FREE(p, n);
+
+	p->freeCount += n;
+}
+
+/*
+Census of the carved blocks, sorted by address so the block holding a
+free element is found by binary search. Only poolTrim() pays for it:
+poolMalloc/poolFree just keep freeCount.
+*/
+typedef struct {
+	uint8_t *start;
+	int32_t index;
+	uint32_t free;
+} poolBlockCensus;
+
+/* Heapsort by start: qsort may call malloc, and pool.c can be behind malloc */
+static void poolCensusSift(poolBlockCensus *c, int32_t root, int32_t n)
+{
+	poolBlockCensus tmp;
+	int32_t child;
+
+	while((child = 2 * root + 1) < n) {
+		if(child + 1 < n && c[child].start < c[child + 1].start)
+			++child;
+		if(c[root].start >= c[child].start)
+			return;
+		tmp = c[root];
+		c[root] = c[child];
+		c[child] = tmp;
+		root = child;
+	}
+}
+
+static void poolCensusSort(poolBlockCensus *c, int32_t n)
+{
+	poolBlockCensus tmp;
+	int32_t i;
+
+	for(i = n / 2 - 1; i >= 0; --i)
+		poolCensusSift(c, i, n);
+	for(i = n - 1; i > 0; --i) {
+		tmp = c[0];
+		c[0] = c[i];
+		c[i] = tmp;
+		poolCensusSift(c, 0, i);
+	}
+}
+
+static poolBlockCensus *poolCensusFind(poolBlockCensus *c, int32_t n, const uint8_t *ptr, size_t bytes)
+{
+	int32_t lo = 0, hi = n - 1, mid;
+
+	while(lo <= hi) {
+		mid = lo + (hi - lo) / 2;
+		if(ptr < c[mid].start)
+			hi = mid - 1;
+		else if(ptr >= c[mid].start + bytes)
+			lo = mid + 1;
+		else
+			return &c[mid];
+	}
+
+	return NULL;
+}
+
+uint32_t poolTrim(pool *p)
+{
+	size_t bytes = (size_t)p->elementSize * p->blockSize;
+	int32_t carved = p->block + 1, i, live = 0, spare;
+	uint32_t released = 0, dropped = 0, capacity;
+	poolBlockCensus *census = NULL, *c;
+	poolFreed **link, *f;
+	uint8_t **order;
+
+	order = POOL_SYS_MALLOC(sizeof(uint8_t*)* p->blocksUsed);
+	if(carved > 0)
+		census = POOL_SYS_MALLOC(sizeof(poolBlockCensus)* carved);
+	if(order == NULL || (carved > 0 && census == NULL)) {
+		POOL_SYS_FREE(order);
+		POOL_SYS_FREE(census);
+		return 0;
+	}
+
+	// count the free elements of every carved block
+	for(i = 0; i < carved; ++i) {
+		census[i].start = p->blocks[i];
+		census[i].index = i;
+		census[i].free = 0;
+	}
+	poolCensusSort(census, carved);
+
+	for(f = p->freed; f != NULL; f = f->nextFree)
+		poolCensusFind(census, carved, (uint8_t *)f, bytes)->free++;
+
+	// an empty block gets free = UINT32_MAX, its elements leave the freed list
+	for(i = 0; i < carved; ++i) {
+		capacity = census[i].index == p->block ? p->used + 1 : p->blockSize;
+		if(census[i].free == capacity)
+			census[i].free = UINT32_MAX;
+	}
+
+	for(link = &p->freed; *link != NULL; ) {
+		if(poolCensusFind(census, carved, (uint8_t *)*link, bytes)->free == UINT32_MAX) {
+			*link = (*link)->nextFree;
+			++dropped;
+		} else {
+			link = &(*link)->nextFree;
+		}
+	}
+	p->freeCount -= dropped;
+
+	// keep the blocks in use first, the current one last among them
+	for(i = 0; i < carved; ++i) {
+		c = poolCensusFind(census, carved, p->blocks[i], bytes);
+		if(c->free != UINT32_MAX && i != p->block)
+			order[live++] = p->blocks[i];
+	}
+	if(carved > 0 && poolCensusFind(census, carved, p->blocks[p->block], bytes)->free != UINT32_MAX) {
+		order[live++] = p->blocks[p->block];
+	} else {
+		// the current block is gone, the next poolMalloc moves on
+		p->used = p->blockSize - 1;
+	}
+	p->block = live - 1;
+
+	// then the empty ones: released, and kept as spares if the backing can trim
+	spare = live;
+	for(i = 0; i < (int32_t)p->blocksUsed; ++i) {
+		if(p->blocks[i] == NULL)
+			continue;
+		if(i < carved && poolCensusFind(census, carved, p->blocks[i], bytes)->free != UINT32_MAX)
+			continue;
+		if(i >= carved && (uint32_t)i >= p->trimmedFrom) {
+			order[spare++] = p->blocks[i];
+			continue;
+		}
+
+		if(p->backing.blockTrim != NULL) {
+			p->backing.blockTrim(p->backing.ctx, p->blocks[i], bytes);
+			order[spare++] = p->blocks[i];
+		} else {
+			p->backing.blockFree(p->backing.ctx, p->blocks[i], bytes);
+			POOL_STATS_BLOCKS(p, -1);
+		}
+		++released;
+	}
+
+	for(i = spare; i < (int32_t)p->blocksUsed; ++i)
+		order[i] = NULL;
+	p->trimmedFrom = live;
+
+	memcpy(p->blocks, order, sizeof(uint8_t*)* p->blocksUsed);
+	POOL_SYS_FREE(order);
+	POOL_SYS_FREE(census);
+
+	// at least highWater more frees before the policy trims again
+	if(p->highWater)
+		p->trimAt = p->freeCount + p->highWater;
+
+	return released;
+}
+#else
+uint32_t poolMallocBatchFrom(pool *p, void **out, uint32_t n, const void *site)
+{
+	uint32_t i;
+
+	(void)site;
+	for(i = 0; i < n; ++i)
+		if((out[i] = poolMalloc(p)) == NULL)
+			break;
+
+	return i;
+}
+
+uint32_t poolMallocBatch(pool *p, void **out, uint32_t n)
+{
+	return poolMallocBatchFrom(p, out, n, NULL);
+}
+
+void poolFreeBatch(pool *p, void **ptrs, uint32_t n)
+{
+	uint32_t i;
+
+	for(i = 0; i < n; ++i)
+		poolFree(p, ptrs[i]);
+}
+
+uint32_t poolTrim(pool *p)
+{
+	return 0;
 }
 #endif
 
+void poolSetTrimPolicy(pool *p, uint32_t highWater)
+{
+	p->highWater = highWater;
+	p->trimAt = highWater ? p->freeCount + highWater : UINT32_MAX;
+}
+
+uint32_t poolTrimIfDue(pool *p)
+{
+	if(p->freeCount <= p->trimAt)
+		return 0;
+
+	return poolTrim(p);
+}
+
 void poolFreeAll(pool *p)
 {
 	p->used = p->blockSize - 1;
 	p->block = -1;
 	p->freed = NULL;
+	p->freeCount = 0;
+	p->trimmedFrom = UINT32_MAX;
+#ifdef POOL_STATS
+	p->stats.live = 0;
+#endif
+	p->trimAt = p->highWater ? p->highWater : UINT32_MAX;
 }
\ No newline at end of file
@@ -1,13 +1,65 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define POOL_BLOCKS_INITIAL 1
 
+/* poolSetMmapBacking() flags */
+#define POOL_MMAP_DONTNEED 1 // poolTrim() keeps the mapping, only drops its pages
+#define POOL_MMAP_HUGE 2 // 2 MB aligned blocks on transparent hugepages
+#define POOL_MMAP_HUGETLB 4 // explicit 2 MB hugepages, falls back to POOL_MMAP_HUGE
+#define POOL_MMAP_NUMA_LOCAL 8 // place each block on the allocating thread's node
+#define POOL_MMAP_CACHELINE 16 // round elementSize up so every element is line aligned
+
+#ifndef POOL_CACHE_LINE
+#define POOL_CACHE_LINE 64
+#endif
+
+/*
+Where blocks come from. Defaults to malloc/free; set with poolSetBacking()
+right after poolInitialize(), before the first poolMalloc().
+blockTrim is optional: when set, poolTrim() hands it an empty block to
+release its memory but keeps the block for reuse, otherwise the block
+goes back through blockFree.
+*/
+typedef struct poolBacking{
+	void *(*blockAlloc)(void *ctx, size_t size);
+	void (*blockFree)(void *ctx, void *block, size_t size);
+	void (*blockTrim)(void *ctx, void *block, size_t size);
+	void *ctx;
+} poolBacking;
+
 typedef struct poolFreed{
 	struct poolFreed *nextFree;
 } poolFreed;
 
+#ifdef POOL_STATS
+#include <stdio.h>
+
+#ifndef POOL_STATS_SAMPLE
+#define POOL_STATS_SAMPLE 64 // record the caller of one allocation in this many
+#endif
+#define POOL_STATS_SITES 16
+
+typedef struct {
+	const void *site; // caller of poolMalloc, or the site given to poolMallocFrom
+	uint64_t samples;
+} poolStatsSite;
+
+/* Counters kept when built with -DPOOL_STATS, the free list length is freeCount */
+typedef struct {
+	uint64_t allocs;
+	uint64_t frees;
+	uint32_t live;
+	uint32_t peakLive;
+	uint32_t blocks; // blocks currently allocated from the backing
+	uint64_t lastAllocs; // allocs and time at the last poolStatsDump(), for the rate
+	uint64_t lastNs;
+	poolStatsSite sites[POOL_STATS_SITES];
+} poolStats;
+#endif
+
 typedef struct {
 	uint32_t elementSize;
 	uint32_t blockSize;
@@ -16,17 +68,64 @@ typedef struct {
 	poolFreed *freed;
 	uint32_t blocksUsed;
 	uint8_t **blocks;
+	poolBacking backing;
+	uint32_t freeCount; // elements on the freed list
+	uint32_t highWater; // trim policy, 0 when off
+	uint32_t trimAt; // freeCount above which poolTrimIfDue() trims
+	uint32_t trimmedFrom; // spare blocks from this index on are already trimmed
+#ifdef POOL_STATS
+	poolStats stats;
+#endif
 } pool;
 
 void poolInitialize(pool *p, const uint32_t elementSize, const uint32_t blockSize);
+void poolSetBacking(pool *p, const poolBacking *backing);
+/*
+Blocks straight from mmap, given back with munmap or madvise (POOL_MMAP_DONTNEED).
+Call right after poolInitialize(): the hugepage flags grow blockSize to
+fill whole 2 MB pages and POOL_MMAP_CACHELINE rounds up elementSize.
+*/
+void poolSetMmapBacking(pool *p, uint32_t flags);
 void poolFreePool(pool *p);
 
+/* Release every block whose elements are all free, returns how many */
+uint32_t poolTrim(pool *p);
+/*
+Trim policy for poolTrimIfDue(): a trim is due once more than highWater
+elements are free, 0 turns it off. poolFree() only counts, the census of
+poolTrim() is O(blocks log blocks) and stays off the free path.
+*/
+void poolSetTrimPolicy(pool *p, uint32_t highWater);
+/* poolTrim() if the policy says so, otherwise a compare: cheap to call periodically */
+uint32_t poolTrimIfDue(pool *p);
+
+/*
+The From variants take the call site POOL_STATS attributes the allocation
+to. poolMalloc/poolMallocBatch use their own caller, so an allocator
+layered on top (slab.c) passes its caller's address down instead.
+*/
 #ifndef DISABLE_MEMORY_POOLING
 void *poolMalloc(pool *p);
+void *poolMallocFrom(pool *p, const void *site);
 void poolFree(pool *p, void *ptr);
 #else
 #include <stdlib.h>
 #define poolMalloc(p) malloc((p)->blockSize)
+#define poolMallocFrom(p, site) malloc((p)->blockSize)
 #define poolFree(p, d) free(d)
 #endif
-void poolFreeAll(pool *p);
\ No newline at end of file
+/*
+Fill out[] with up to n elements, returns how many. Fewer than n only when
+the backing is out of memory: out[0..ret) are allocated and the caller's
+to keep or give back, the rest of out[] holds no element.
+*/
+uint32_t poolMallocBatch(pool *p, void **out, uint32_t n);
+uint32_t poolMallocBatchFrom(pool *p, void **out, uint32_t n, const void *site);
+/* Every ptrs[i] must be a live element of p, n may be 0; ptrs[] itself is not kept */
+void poolFreeBatch(pool *p, void **ptrs, uint32_t n);
+void poolFreeAll(pool *p);
+
+#ifdef POOL_STATS
+/* Counters, allocation rate since the previous dump and the hottest call sites */
+void poolStatsDump(pool *p, FILE *out);
+#endif
\ No newline at end of file
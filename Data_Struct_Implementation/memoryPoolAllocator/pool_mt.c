@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pool_mt.h"
+
+#define TAG_SHIFT 48
+#define PTR_MASK ((1ull << TAG_SHIFT) - 1)
+#define ELEMENT_ALIGN 16
+
+static inline poolMagazine *tagPtr(uint64_t v)
+{
+	return (poolMagazine *)(uintptr_t)(v & PTR_MASK);
+}
+
+static inline uint64_t tagMake(poolMagazine *m, uint64_t old)
+{
+	return ((old >> TAG_SHIFT) + 1) << TAG_SHIFT | (uint64_t)(uintptr_t)m;
+}
+
+static void depotPush(poolDepot *d, poolMagazine *m)
+{
+	uint64_t old = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+	do {
+		atomic_store_explicit(&m->next, tagPtr(old), memory_order_relaxed);
+	} while(!atomic_compare_exchange_weak_explicit(&d->top, &old, tagMake(m, old),
+			memory_order_release, memory_order_relaxed));
+}
+
+static poolMagazine *depotPop(poolDepot *d)
+{
+	uint64_t old = atomic_load_explicit(&d->top, memory_order_acquire);
+	poolMagazine *m;
+
+	do {
+		m = tagPtr(old);
+		if(m == NULL)
+			return NULL;
+		// m may already be popped and reused: the tag makes that CAS fail
+	} while(!atomic_compare_exchange_weak_explicit(&d->top, &old,
+			tagMake(atomic_load_explicit(&m->next, memory_order_relaxed), old),
+			memory_order_acquire, memory_order_acquire));
+
+	return m;
+}
+
+static poolMagazine *newMagazine(poolMt *p)
+{
+	poolMagazine *m = depotPop(&p->empty);
+
+	if(m != NULL)
+		return m;
+
+	m = malloc(sizeof(poolMagazine));
+	if(m == NULL)
+		return NULL;
+
+	m->count = 0;
+	m->allNext = atomic_load_explicit(&p->magazines, memory_order_relaxed);
+	while(!atomic_compare_exchange_weak_explicit(&p->magazines, &m->allNext, m,
+			memory_order_release, memory_order_relaxed));
+
+	return m;
+}
+
+/* Carve a fresh chunk of POOL_MAGAZINE_SIZE elements into an empty magazine */
+static int refill(poolMt *p, poolMagazine *m)
+{
+	poolChunk *c = malloc(ELEMENT_ALIGN + (size_t)p->elementSize * POOL_MAGAZINE_SIZE);
+	uint8_t *elements;
+	uint32_t i;
+
+	if(c == NULL)
+		return -1;
+
+	c->next = atomic_load_explicit(&p->chunks, memory_order_relaxed);
+	while(!atomic_compare_exchange_weak_explicit(&p->chunks, &c->next, c,
+			memory_order_release, memory_order_relaxed));
+
+	elements = (uint8_t *)c + ELEMENT_ALIGN;
+	for(i = 0; i < POOL_MAGAZINE_SIZE; ++i)
+		m->rounds[i] = elements + (size_t)i * p->elementSize;
+	m->count = POOL_MAGAZINE_SIZE;
+
+	return 0;
+}
+
+/* Thread exit: hand the thread's magazines back to the depot */
+static void cacheRelease(void *arg)
+{
+	poolMtCache *c = arg;
+	poolMagazine *m[2] = { c->loaded, c->previous };
+	uint32_t i;
+
+	for(i = 0; i < 2; ++i) {
+		if(m[i] == NULL)
+			continue;
+		depotPush(m[i]->count ? &c->p->full : &c->p->empty, m[i]);
+	}
+
+	c->loaded = NULL;
+	c->previous = NULL;
+}
+
+static poolMtCache *getCache(poolMt *p)
+{
+	poolMtCache *c = pthread_getspecific(p->cacheKey);
+
+	if(c != NULL)
+		return c;
+
+	c = malloc(sizeof(poolMtCache));
+	if(c == NULL)
+		return NULL;
+
+	c->p = p;
+	c->loaded = newMagazine(p);
+	c->previous = newMagazine(p);
+	if(c->loaded == NULL || c->previous == NULL) {
+		cacheRelease(c);
+		free(c);
+		return NULL;
+	}
+
+	c->next = atomic_load_explicit(&p->caches, memory_order_relaxed);
+	while(!atomic_compare_exchange_weak_explicit(&p->caches, &c->next, c,
+			memory_order_release, memory_order_relaxed));
+
+	pthread_setspecific(p->cacheKey, c);
+
+	return c;
+}
+
+int poolMtInitialize(poolMt *p, const uint32_t elementSize)
+{
+	p->elementSize = (elementSize + ELEMENT_ALIGN - 1) & ~(ELEMENT_ALIGN - 1);
+	atomic_init(&p->full.top, 0);
+	atomic_init(&p->empty.top, 0);
+	atomic_init(&p->chunks, NULL);
+	atomic_init(&p->magazines, NULL);
+	atomic_init(&p->caches, NULL);
+
+	return pthread_key_create(&p->cacheKey, cacheRelease);
+}
+
+/* Only call once no other thread uses the pool any more */
+void poolMtFreePool(poolMt *p)
+{
+	poolChunk *chunk, *nextChunk;
+	poolMagazine *m, *nextMagazine;
+	poolMtCache *c, *nextCache;
+
+	pthread_key_delete(p->cacheKey);
+
+	for(c = atomic_load(&p->caches); c != NULL; c = nextCache) {
+		nextCache = c->next;
+		free(c);
+	}
+
+	for(m = atomic_load(&p->magazines); m != NULL; m = nextMagazine) {
+		nextMagazine = m->allNext;
+		free(m);
+	}
+
+	for(chunk = atomic_load(&p->chunks); chunk != NULL; chunk = nextChunk) {
+		nextChunk = chunk->next;
+		free(chunk);
+	}
+}
+
+void *poolMtMalloc(poolMt *p)
+{
+	poolMtCache *c = getCache(p);
+	poolMagazine *m;
+
+	if(c == NULL)
+		return NULL;
+
+	if(c->loaded->count == 0) {
+		if(c->previous->count == 0) {
+			// both magazines empty: trade one for a full one from the depot
+			m = depotPop(&p->full);
+			if(m != NULL)
+				depotPush(&p->empty, c->previous);
+			else if(refill(p, c->previous) == 0)
+				m = c->previous;
+			else
+				return NULL;
+			c->previous = m;
+		}
+
+		m = c->loaded;
+		c->loaded = c->previous;
+		c->previous = m;
+	}
+
+	return c->loaded->rounds[--c->loaded->count];
+}
+
+void poolMtFree(poolMt *p, void *ptr)
+{
+	poolMtCache *c = getCache(p);
+	poolMagazine *m;
+
+	if(c == NULL) {
+		fprintf(stderr, "poolMtFree: out of memory for the thread cache\n");
+		abort();
+	}
+
+	if(c->loaded->count == POOL_MAGAZINE_SIZE) {
+		if(c->previous->count == POOL_MAGAZINE_SIZE) {
+			// both magazines full: give one to the depot, take an empty one
+			m = newMagazine(p);
+			if(m == NULL) {
+				fprintf(stderr, "poolMtFree: out of memory for a magazine\n");
+				abort();
+			}
+			depotPush(&p->full, c->previous);
+			c->previous = m;
+		}
+
+		m = c->loaded;
+		c->loaded = c->previous;
+		c->previous = m;
+	}
+
+	c->loaded->rounds[c->loaded->count++] = ptr;
+}
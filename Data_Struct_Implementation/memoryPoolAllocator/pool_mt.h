@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define POOL_MAGAZINE_SIZE 64
+#define POOL_CACHE_LINE 64
+
+/*
+A magazine is a small stack of free elements. Threads allocate and free
+from magazines they own, without atomics; full and empty magazines are
+traded with the shared depot.
+*/
+typedef struct poolMagazine{
+	_Atomic(struct poolMagazine *) next; // depot link
+	struct poolMagazine *allNext; // every magazine of the pool, for poolMtFreePool
+	uint32_t count;
+	void *rounds[POOL_MAGAZINE_SIZE];
+} poolMagazine;
+
+/*
+Lock-free stack of magazines. The top pointer carries a 16-bit version
+tag in its upper bits (user space addresses fit in 48 bits), bumped on
+every update so a pop cannot succeed against a recycled top (ABA).
+Magazines are never freed while the pool lives, so reading next of a
+stale top is harmless.
+*/
+typedef struct {
+	_Alignas(POOL_CACHE_LINE) _Atomic uint64_t top;
+} poolDepot;
+
+typedef struct poolChunk{
+	struct poolChunk *next;
+} poolChunk;
+
+typedef struct poolMtCache poolMtCache;
+
+typedef struct poolMt{
+	poolDepot full;
+	poolDepot empty;
+	_Alignas(POOL_CACHE_LINE) _Atomic(poolChunk *) chunks;
+	_Atomic(poolMagazine *) magazines;
+	_Atomic(poolMtCache *) caches;
+	uint32_t elementSize;
+	pthread_key_t cacheKey;
+} poolMt;
+
+/*
+Per-thread, per-pool cache: the loaded magazine serves requests, the
+previous one absorbs alloc/free ping-pong at a magazine boundary.
+*/
+struct poolMtCache{
+	poolMt *p;
+	poolMagazine *loaded;
+	poolMagazine *previous;
+	poolMtCache *next;
+};
+
+int poolMtInitialize(poolMt *p, const uint32_t elementSize);
+void poolMtFreePool(poolMt *p);
+void *poolMtMalloc(poolMt *p);
+void poolMtFree(poolMt *p, void *ptr);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define POOL_STATIC_NULL 0 // handle never returned for an element
+
+/*
+Fixed-capacity pool sized at compile time, for threads that must not
+call malloc. Elements are named by handles of handleType (uint16_t or
+uint32_t), index + 1 so that 0 is the null handle: capacity can go up
+to the largest handleType value, 65535 elements for uint16_t. Free and
+Get do not check their handle, POOL_STATIC_NULL or a freed handle is a
+bug in the caller, as with a dangling pointer. Free elements keep
+the next free handle in their first bytes instead of a poolFreed
+pointer, so elements only need to be as large as a handle.
+
+Elements are carved in order from 'carved', then recycled through the
+free chain: both are O(1) with no loop, and an all-zero instance (any
+static one) is an empty pool ready to use.
+
+	struct timer {
+		uint64_t expiry;
+		uint64_t period;
+	};
+
+	POOL_STATIC_DEFINE(timerPool, struct timer, uint16_t, 1024)
+	static timerPool timers;
+
+	timerPoolHandle h = timerPoolMalloc(&timers);
+	timerPoolGet(&timers, h)->expiry = now + period;
+	timerPoolFree(&timers, h);
+
+Not thread safe: one owner per instance.
+*/
+#define POOL_STATIC_DEFINE(name, type, handleType, capacity) \
+_Static_assert((capacity) > 0 && (uint64_t)(capacity) <= (handleType)~(handleType)0, \
+		#name ": capacity does not fit in " #handleType); \
+typedef handleType name##Handle; \
+typedef struct { \
+	union { \
+		type value; \
+		handleType nextFree; \
+	} slots[capacity]; \
+	handleType freed; \
+	handleType carved; \
+} name; \
+\
+static inline void name##FreeAll(name *p) \
+{ \
+	p->freed = POOL_STATIC_NULL; \
+	p->carved = 0; \
+} \
+\
+/* POOL_STATIC_NULL when all capacity elements are in use */ \
+static inline name##Handle name##Malloc(name *p) \
+{ \
+	handleType h = p->freed; \
+\
+	if(h != POOL_STATIC_NULL) { \
+		p->freed = p->slots[h - 1].nextFree; \
+		return h; \
+	} \
+	if(p->carved == (capacity)) \
+		return POOL_STATIC_NULL; \
+	return ++p->carved; \
+} \
+\
+static inline void name##Free(name *p, name##Handle h) \
+{ \
+	p->slots[h - 1].nextFree = p->freed; \
+	p->freed = h; \
+} \
+\
+static inline type *name##Get(name *p, name##Handle h) \
+{ \
+	return &p->slots[h - 1].value; \
+}
@@ -0,0 +1,432 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "slab.h"
+
+#define SLAB_SPIN_LIMIT 128
+#define SLAB_TRIM_SPANS 4
+
+/* slabThreadCache.state */
+#define SLAB_CACHE_NEW 0
+#define SLAB_CACHE_LIVE 1
+#define SLAB_CACHE_DEAD 2 // thread exiting, straight to the classes
+
+typedef struct {
+	uint32_t state;
+	slabMagazine magazines[SLAB_CACHE_CLASSES];
+} slabThreadCache;
+
+static slabClass classes[SLAB_NUM_CLASSES];
+static pthread_once_t slabOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t cacheKey;
+// initial-exec: no __tls_get_addr on the malloc path, it may allocate itself
+static __thread slabThreadCache threadCache __attribute__((tls_model("initial-exec")));
+
+static inline uint32_t sizeClass(size_t size)
+{
+	size_t s;
+	uint32_t k;
+
+	if(size <= SLAB_SMALL_CLASSES * SLAB_ALIGN)
+		return size == 0 ? 0 : (uint32_t)((size - 1) / SLAB_ALIGN);
+
+	// size in (2^k, 2^(k+1)]: the next SLAB_STEPS_LOG2 bits pick the step
+	s = size - 1;
+	k = 63 - __builtin_clzll(s);
+	return SLAB_SMALL_CLASSES + ((k - SLAB_SMALL_LOG2) << SLAB_STEPS_LOG2)
+		+ (uint32_t)(s >> (k - SLAB_STEPS_LOG2)) - (1u << SLAB_STEPS_LOG2);
+}
+
+static uint32_t classSize(uint32_t c)
+{
+	uint32_t k;
+
+	if(c < SLAB_SMALL_CLASSES)
+		return (c + 1) * SLAB_ALIGN;
+
+	c -= SLAB_SMALL_CLASSES;
+	k = SLAB_SMALL_LOG2 + (c >> SLAB_STEPS_LOG2);
+	return (1u << k) + ((c & ((1u << SLAB_STEPS_LOG2) - 1)) + 1) * (1u << (k - SLAB_STEPS_LOG2));
+}
+
+static inline slabSpan *spanOf(void *ptr)
+{
+	return (slabSpan *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SPAN_SIZE - 1));
+}
+
+/* Map size bytes (page multiple) starting on a SLAB_SPAN_SIZE boundary */
+static slabSpan *spanMap(size_t size, uint32_t sizeClass)
+{
+	uint8_t *raw, *span;
+	size_t lead;
+	slabSpan *s;
+
+	raw = mmap(NULL, size + SLAB_SPAN_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(raw == MAP_FAILED)
+		return NULL;
+
+	// trim the over-mapping down to the aligned span
+	span = (uint8_t *)(((uintptr_t)raw + SLAB_SPAN_SIZE - 1) & ~(uintptr_t)(SLAB_SPAN_SIZE - 1));
+	lead = span - raw;
+	if(lead)
+		munmap(raw, lead);
+	if(SLAB_SPAN_SIZE - lead)
+		munmap(span + size, SLAB_SPAN_SIZE - lead);
+
+	s = (slabSpan *)span;
+	s->magic = SLAB_SPAN_MAGIC;
+	s->sizeClass = sizeClass;
+	s->mapSize = size;
+	return s;
+}
+
+/* Pool backing: every block of a class is one span */
+static void *classBlockAlloc(void *ctx, size_t size)
+{
+	slabClass *c = ctx;
+	slabSpan *s = spanMap(SLAB_SPAN_SIZE, c - classes);
+
+	(void)size;
+	return s == NULL ? NULL : (uint8_t *)s + SLAB_SPAN_HEADER;
+}
+
+static void classBlockFree(void *ctx, void *block, size_t size)
+{
+	(void)ctx;
+	(void)size;
+	munmap((uint8_t *)block - SLAB_SPAN_HEADER, SLAB_SPAN_SIZE);
+}
+
+static void classLock(slabClass *c)
+{
+	uint32_t spins = 0;
+
+	while(atomic_exchange_explicit(&c->lock, 1, memory_order_acquire)) {
+		while(atomic_load_explicit(&c->lock, memory_order_relaxed)) {
+			if(++spins > SLAB_SPIN_LIMIT)
+				sched_yield();
+		}
+	}
+}
+
+static inline void classUnlock(slabClass *c)
+{
+	atomic_store_explicit(&c->lock, 0, memory_order_release);
+}
+
+/*
+A fork() while another thread holds a class lock would leave it locked
+forever in the child: hold them all across the fork, as glibc does with
+its arenas.
+*/
+static void forkPrepare(void)
+{
+	uint32_t i;
+
+	for(i = 0; i < SLAB_NUM_CLASSES; ++i)
+		classLock(&classes[i]);
+}
+
+static void forkParent(void)
+{
+	uint32_t i;
+
+	for(i = 0; i < SLAB_NUM_CLASSES; ++i)
+		classUnlock(&classes[i]);
+}
+
+static void forkChild(void)
+{
+	uint32_t i;
+
+	for(i = 0; i < SLAB_NUM_CLASSES; ++i)
+		atomic_store_explicit(&classes[i].lock, 0, memory_order_relaxed);
+}
+
+/* The cached elements go back to their classes */
+static void cacheFlush(slabThreadCache *t)
+{
+	slabMagazine *m;
+	slabClass *c;
+	uint32_t i;
+
+	for(i = 0; i < SLAB_CACHE_CLASSES; ++i) {
+		m = &t->magazines[i];
+		if(m->count == 0)
+			continue;
+
+		c = &classes[i];
+		classLock(c);
+		poolFreeBatch(&c->p, m->rounds, m->count);
+		classUnlock(c);
+		m->count = 0;
+	}
+}
+
+/* Thread exit, a later free from another destructor goes straight to its class */
+static void cacheRelease(void *arg)
+{
+	slabThreadCache *t = arg;
+
+	t->state = SLAB_CACHE_DEAD;
+	cacheFlush(t);
+}
+
+static void slabOnceInit(void)
+{
+	pthread_atfork(forkPrepare, forkParent, forkChild);
+	pthread_key_create(&cacheKey, cacheRelease);
+}
+
+/* The calling thread's magazine for sizeClass, NULL if the class has none */
+static inline slabMagazine *threadMagazine(uint32_t sizeClass)
+{
+	slabThreadCache *t = &threadCache;
+
+	if(sizeClass >= SLAB_CACHE_CLASSES || t->state == SLAB_CACHE_DEAD)
+		return NULL;
+
+	if(t->state == SLAB_CACHE_NEW) {
+		pthread_once(&slabOnce, slabOnceInit);
+		// live first: pthread_setspecific may allocate and come back here
+		t->state = SLAB_CACHE_LIVE;
+		pthread_setspecific(cacheKey, t);
+	}
+
+	return &t->magazines[sizeClass];
+}
+
+/* Called with the class locked */
+static void classInit(slabClass *c)
+{
+	poolBacking backing = {
+		.blockAlloc = classBlockAlloc,
+		.blockFree = classBlockFree,
+		.ctx = c,
+	};
+	uint32_t perSpan;
+
+	c->size = classSize(c - classes);
+	perSpan = (SLAB_SPAN_SIZE - SLAB_SPAN_HEADER) / c->size;
+	poolInitialize(&c->p, c->size, perSpan);
+	poolSetBacking(&c->p, &backing);
+	// xtrim() hands empty spans back once a class holds SLAB_TRIM_SPANS spans worth of free elements
+	poolSetTrimPolicy(&c->p, SLAB_TRIM_SPANS * perSpan);
+	c->ready = 1;
+}
+
+/* Large requests get a span of their own, the data starts offset bytes in */
+static void *largeAlloc(size_t size, size_t offset)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	slabSpan *s;
+
+	if(size > SIZE_MAX - offset - SLAB_SPAN_SIZE - page) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	s = spanMap((offset + size + page - 1) & ~(page - 1), SLAB_LARGE);
+	if(s == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return (uint8_t *)s + offset;
+}
+
+/* site is the caller POOL_STATS charges, a refill counts whole against it */
+static void *classAlloc(uint32_t sizeClass, const void *site)
+{
+	slabMagazine *m = threadMagazine(sizeClass);
+	slabClass *c = &classes[sizeClass];
+	void *ptr;
+
+	if(m != NULL && m->count)
+		return m->rounds[--m->count];
+
+	// before the first lock is ever taken
+	pthread_once(&slabOnce, slabOnceInit);
+	classLock(c);
+	if(!c->ready)
+		classInit(c);
+	if(m != NULL) {
+		// half a magazine per lock round trip
+		m->count = poolMallocBatchFrom(&c->p, m->rounds, SLAB_MAGAZINE_BATCH, site);
+		ptr = m->count ? m->rounds[--m->count] : NULL;
+	} else {
+		ptr = poolMallocFrom(&c->p, site);
+	}
+	classUnlock(c);
+
+	if(ptr == NULL)
+		errno = ENOMEM;
+	return ptr;
+}
+
+void *xmallocFrom(size_t size, const void *site)
+{
+	if(size > SLAB_MAX_SIZE)
+		return largeAlloc(size, SLAB_SPAN_HEADER);
+
+	return classAlloc(sizeClass(size), site);
+}
+
+void *xmalloc(size_t size)
+{
+	return xmallocFrom(size, __builtin_return_address(0));
+}
+
+void xfree(void *ptr)
+{
+	slabMagazine *m;
+	slabSpan *s;
+	slabClass *c;
+
+	if(ptr == NULL)
+		return;
+
+	s = spanOf(ptr);
+	if(s->sizeClass == SLAB_LARGE) {
+		munmap(s, s->mapSize);
+		return;
+	}
+
+	m = threadMagazine(s->sizeClass);
+	if(m != NULL && m->count < SLAB_MAGAZINE_SIZE) {
+		m->rounds[m->count++] = ptr;
+		return;
+	}
+
+	c = &classes[s->sizeClass];
+	classLock(c);
+	if(m != NULL) {
+		// full: the oldest half goes back, the recently freed, cache-hot half stays
+		poolFreeBatch(&c->p, m->rounds, SLAB_MAGAZINE_BATCH);
+		m->count -= SLAB_MAGAZINE_BATCH;
+		memmove(m->rounds, m->rounds + SLAB_MAGAZINE_BATCH, m->count * sizeof(void *));
+		m->rounds[m->count++] = ptr;
+	} else {
+		poolFree(&c->p, ptr);
+	}
+	classUnlock(c);
+}
+
+uint32_t xtrim(void)
+{
+	uint32_t released = 0, i;
+	slabClass *c;
+
+	if(threadCache.state == SLAB_CACHE_LIVE)
+		cacheFlush(&threadCache);
+
+	for(i = 0; i < SLAB_NUM_CLASSES; ++i) {
+		c = &classes[i];
+		classLock(c);
+		if(c->ready)
+			released += poolTrimIfDue(&c->p);
+		classUnlock(c);
+	}
+
+	return released;
+}
+
+size_t xmallocUsableSize(void *ptr)
+{
+	slabSpan *s;
+
+	if(ptr == NULL)
+		return 0;
+
+	s = spanOf(ptr);
+	if(s->sizeClass == SLAB_LARGE)
+		return s->mapSize - ((uint8_t *)ptr - (uint8_t *)s);
+
+	return classes[s->sizeClass].size;
+}
+
+void *xreallocFrom(void *ptr, size_t size, const void *site)
+{
+	size_t old;
+	void *n;
+
+	if(ptr == NULL)
+		return xmallocFrom(size, site);
+
+	if(size == 0) {
+		xfree(ptr);
+		return NULL;
+	}
+
+	// stay put unless the block would end up mostly empty
+	old = xmallocUsableSize(ptr);
+	if(size <= old && size > old / 2)
+		return ptr;
+
+	n = xmallocFrom(size, site);
+	if(n == NULL)
+		return NULL;
+
+	memcpy(n, ptr, size < old ? size : old);
+	xfree(ptr);
+	return n;
+}
+
+void *xrealloc(void *ptr, size_t size)
+{
+	return xreallocFrom(ptr, size, __builtin_return_address(0));
+}
+
+void *xcallocFrom(size_t n, size_t size, const void *site)
+{
+	void *ptr;
+
+	if(size && n > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	ptr = xmallocFrom(n * size, site);
+	// fresh mappings are already zero, recycled elements are not
+	if(ptr != NULL && n * size <= SLAB_MAX_SIZE)
+		memset(ptr, 0, n * size);
+	return ptr;
+}
+
+void *xcalloc(size_t n, size_t size)
+{
+	return xcallocFrom(n, size, __builtin_return_address(0));
+}
+
+void *xmemalignFrom(size_t alignment, size_t size, const void *site)
+{
+	uint32_t c;
+
+	if(alignment == 0 || (alignment & (alignment - 1)) || alignment >= SLAB_SPAN_SIZE) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if(alignment <= SLAB_ALIGN)
+		return xmallocFrom(size, site);
+
+	// elements start at SLAB_SPAN_HEADER + i * size: aligned if size is a multiple
+	if(alignment <= SLAB_SPAN_HEADER && size <= SLAB_MAX_SIZE) {
+		for(c = sizeClass(size); c < SLAB_NUM_CLASSES; ++c) {
+			if(classSize(c) % alignment == 0)
+				return classAlloc(c, site);
+		}
+	}
+
+	return largeAlloc(size, alignment > SLAB_SPAN_HEADER ? alignment : SLAB_SPAN_HEADER);
+}
+
+void *xmemalign(size_t alignment, size_t size)
+{
+	return xmemalignFrom(alignment, size, __builtin_return_address(0));
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "pool.h"
+
+#define SLAB_MIN_SIZE 16
+#define SLAB_MAX_SIZE (32 * 1024)
+#define SLAB_ALIGN 16
+
+/* 16..128 in steps of 16, then four classes per power of two up to 32 KB */
+#define SLAB_SMALL_CLASSES 8
+#define SLAB_SMALL_LOG2 7 // log2(SLAB_SMALL_CLASSES * SLAB_ALIGN)
+#define SLAB_MAX_LOG2 15
+#define SLAB_STEPS_LOG2 2
+#define SLAB_NUM_CLASSES (SLAB_SMALL_CLASSES + ((SLAB_MAX_LOG2 - SLAB_SMALL_LOG2) << SLAB_STEPS_LOG2))
+
+/*
+Every allocation lives in a span aligned to SLAB_SPAN_SIZE whose first
+SLAB_SPAN_HEADER bytes say what it holds, so xfree() finds the size
+class of a pointer by masking it, without a header per object.
+*/
+#define SLAB_SPAN_SIZE (256 * 1024)
+#define SLAB_SPAN_HEADER 64
+#define SLAB_SPAN_MAGIC 0x51ab51abu
+#define SLAB_LARGE UINT32_MAX
+
+typedef struct {
+	uint32_t magic;
+	uint32_t sizeClass; // index into the classes, or SLAB_LARGE
+	size_t mapSize; // bytes mapped for the span
+} slabSpan;
+
+/*
+Classes up to 2^SLAB_CACHE_LOG2 bytes also get a per-thread magazine in
+front of their lock, in the style of glibc's tcache: xmalloc/xfree pop
+and push it without a lock or an atomic, and the class is only locked to
+move SLAB_MAGAZINE_BATCH elements in or out at once. Bigger classes take
+the class lock on every call.
+*/
+#define SLAB_CACHE_LOG2 10
+#define SLAB_CACHE_CLASSES (SLAB_SMALL_CLASSES + ((SLAB_CACHE_LOG2 - SLAB_SMALL_LOG2) << SLAB_STEPS_LOG2))
+#define SLAB_MAGAZINE_SIZE 32
+#define SLAB_MAGAZINE_BATCH 16
+
+typedef struct {
+	uint32_t count;
+	void *rounds[SLAB_MAGAZINE_SIZE];
+} slabMagazine;
+
+/* One pool per size class, each behind its own spinlock */
+typedef struct {
+	_Atomic uint32_t lock;
+	uint32_t ready;
+	uint32_t size;
+	pool p;
+} slabClass;
+
+void *xmalloc(size_t size);
+void xfree(void *ptr);
+void *xrealloc(void *ptr, size_t size);
+void *xcalloc(size_t n, size_t size);
+/* alignment is a power of two below SLAB_SPAN_SIZE */
+void *xmemalign(size_t alignment, size_t size);
+size_t xmallocUsableSize(void *ptr);
+/*
+The same with the call site POOL_STATS records given explicitly, for
+wrappers such as slab_preload.c that want their own caller charged
+*/
+void *xmallocFrom(size_t size, const void *site);
+void *xreallocFrom(void *ptr, size_t size, const void *site);
+void *xcallocFrom(size_t n, size_t size, const void *site);
+void *xmemalignFrom(size_t alignment, size_t size, const void *site);
+/*
+Give the empty spans of the classes whose trim is due back to the OS,
+returns how many. xfree() never trims, call this from an idle or timer
+path; a class with nothing due costs a lock and a compare. The calling
+thread's magazines are flushed first, other threads keep theirs.
+*/
+uint32_t xtrim(void);
@@ -0,0 +1,99 @@
+/*
+LD_PRELOAD shim routing the C allocation API to the slab allocator:
+
+	make libslab.so
+	LD_PRELOAD=$PWD/libslab.so ./your_program
+
+Built with POOL_SYS_LIBC so the pools' own bookkeeping goes to glibc
+instead of recursing into these functions, and with hidden visibility so
+only the functions below are exported: a program with its own xmalloc
+(bash has one) must not capture the shim's calls.
+*/
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "slab.h"
+
+#pragma GCC visibility push(default)
+
+void *malloc(size_t size)
+{
+	return xmallocFrom(size, __builtin_return_address(0));
+}
+
+void free(void *ptr)
+{
+	xfree(ptr);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	return xcallocFrom(n, size, __builtin_return_address(0));
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	return xreallocFrom(ptr, size, __builtin_return_address(0));
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	return xmemalignFrom(alignment, size, __builtin_return_address(0));
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	return xmemalignFrom(alignment, size, __builtin_return_address(0));
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *ptr;
+
+	if(alignment < sizeof(void *))
+		return EINVAL;
+
+	ptr = xmemalignFrom(alignment, size, __builtin_return_address(0));
+	if(ptr == NULL)
+		return errno;
+
+	*memptr = ptr;
+	return 0;
+}
+
+void *valloc(size_t size)
+{
+	return xmemalignFrom((size_t)sysconf(_SC_PAGESIZE), size, __builtin_return_address(0));
+}
+
+void *pvalloc(size_t size)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+	return xmemalignFrom(page, (size + page - 1) & ~(page - 1), __builtin_return_address(0));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+	return xmallocUsableSize(ptr);
+}
+
+/* glibc's way to ask for memory back, pad is ignored: spans are released whole */
+int malloc_trim(size_t pad)
+{
+	(void)pad;
+	return xtrim() != 0;
+}
+
+void *reallocarray(void *ptr, size_t n, size_t size)
+{
+	if(size && n > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return xreallocFrom(ptr, n * size, __builtin_return_address(0));
+}
+
+#pragma GCC visibility pop
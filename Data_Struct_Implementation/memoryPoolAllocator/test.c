@@ -1,6 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "pool.h"
+#include "pool_mt.h"
+#include "slab.h"
+#include "arena.h"
+#include "pool_static.h"
 
 #define SUCCESS 0
 #define FAILURE -1
@@ -35,6 +45,631 @@ int  test_pool(int element_size, int block_size)
 	return SUCCESS;
 }
 
+#define BATCH_COUNT 100
+
+int test_pool_batch(int element_size, int block_size)
+{
+	pool pool_ptr;
+	void *ptrs[BATCH_COUNT];
+	int i, j;
+
+	poolInitialize(&pool_ptr, element_size, block_size);
+
+	/* spans several blocks */
+	if(poolMallocBatch(&pool_ptr, ptrs, BATCH_COUNT) != BATCH_COUNT)
+		return FAILURE;
+	for(i = 0; i < BATCH_COUNT; i++)
+		memset(ptrs[i], i, element_size);
+
+	/* give back every other element, then take them back plus fresh ones */
+	for(i = 0, j = 0; i < BATCH_COUNT; i += 2)
+		ptrs[j++] = ptrs[i];
+	poolFreeBatch(&pool_ptr, ptrs, j);
+	if(poolMallocBatch(&pool_ptr, ptrs, BATCH_COUNT) != BATCH_COUNT)
+		return FAILURE;
+	for(i = 0; i < BATCH_COUNT; i++)
+		memset(ptrs[i], 0xff, element_size);
+
+	/* no two elements handed out may overlap */
+	for(i = 0; i < BATCH_COUNT; i++)
+		for(j = i + 1; j < BATCH_COUNT; j++)
+			if((uint8_t *)ptrs[i] < (uint8_t *)ptrs[j] + element_size
+					&& (uint8_t *)ptrs[j] < (uint8_t *)ptrs[i] + element_size)
+				return FAILURE;
+
+	poolFreePool(&pool_ptr);
+
+	return SUCCESS;
+}
+
+#define TRIM_BLOCK 16
+#define TRIM_COUNT (10 * TRIM_BLOCK)
+
+static int count_blocks(pool *p)
+{
+	uint32_t i;
+	int n = 0;
+
+	for(i = 0; i < p->blocksUsed; i++)
+		if(p->blocks[i] != NULL)
+			n++;
+
+	return n;
+}
+
+int test_pool_trim(int mmap_flags)
+{
+	pool pool_ptr;
+	void *ptrs[TRIM_COUNT];
+	uint32_t kept = 0;
+	int i;
+
+	poolInitialize(&pool_ptr, 64, TRIM_BLOCK);
+	if(mmap_flags >= 0)
+		poolSetMmapBacking(&pool_ptr, mmap_flags);
+
+	if(poolMallocBatch(&pool_ptr, ptrs, TRIM_COUNT) != TRIM_COUNT)
+		return FAILURE;
+	for(i = 0; i < TRIM_COUNT; i++)
+		memset(ptrs[i], i, 64);
+
+	/* one element survives in the first and the sixth block */
+	for(i = 0; i < TRIM_COUNT; i++) {
+		if(i == 3 || i == 5 * TRIM_BLOCK + 7)
+			ptrs[kept++] = ptrs[i];
+		else
+			poolFree(&pool_ptr, ptrs[i]);
+	}
+
+	if(poolTrim(&pool_ptr) != 8 || pool_ptr.freeCount != 2 * (TRIM_BLOCK - 1))
+		return FAILURE;
+	if(((uint8_t *)ptrs[0])[0] != 3 || ((uint8_t *)ptrs[1])[63] != (uint8_t)(5 * TRIM_BLOCK + 7))
+		return FAILURE;
+
+	/* nothing left to release, and the pool still serves every element */
+	if(poolTrim(&pool_ptr) != 0)
+		return FAILURE;
+	if(poolMallocBatch(&pool_ptr, ptrs + kept, TRIM_COUNT - kept) != TRIM_COUNT - kept)
+		return FAILURE;
+	for(i = 0; i < TRIM_COUNT; i++)
+		memset(ptrs[i], i, 64);
+	for(i = 0; i < TRIM_COUNT; i++)
+		if(((uint8_t *)ptrs[i])[0] != (uint8_t)i)
+			return FAILURE;
+
+	/* policy: frees never trim, poolTrimIfDue() does once highWater is crossed */
+	poolSetTrimPolicy(&pool_ptr, 2 * TRIM_BLOCK);
+	poolFreeBatch(&pool_ptr, ptrs, TRIM_BLOCK);
+	if(poolTrimIfDue(&pool_ptr) != 0)
+		return FAILURE;
+	poolFreeBatch(&pool_ptr, ptrs + TRIM_BLOCK, TRIM_COUNT / 2 - TRIM_BLOCK);
+	for(i = TRIM_COUNT / 2; i < TRIM_COUNT; i++)
+		poolFree(&pool_ptr, ptrs[i]);
+	if(pool_ptr.freeCount != TRIM_COUNT)
+		return FAILURE;
+	if(poolTrimIfDue(&pool_ptr) == 0 || poolTrimIfDue(&pool_ptr) != 0)
+		return FAILURE;
+	if(mmap_flags <= 0 && count_blocks(&pool_ptr) > 1)
+		return FAILURE;
+	if(pool_ptr.freeCount > TRIM_BLOCK)
+		return FAILURE;
+
+	poolFreePool(&pool_ptr);
+
+	return SUCCESS;
+}
+
+#define MMAP_COUNT 50000
+
+int test_pool_mmap(uint32_t flags)
+{
+	pool pool_ptr;
+	uint8_t **ptrs;
+	size_t bytes;
+	int i;
+
+	ptrs = malloc(MMAP_COUNT * sizeof(uint8_t *));
+	if(ptrs == NULL)
+		return FAILURE;
+
+	poolInitialize(&pool_ptr, 40, 1000);
+	poolSetMmapBacking(&pool_ptr, flags);
+
+	/* hugepage blocks fill their 2 MB pages up to the last whole element */
+	bytes = (size_t)pool_ptr.elementSize * pool_ptr.blockSize;
+	if((flags & (POOL_MMAP_HUGE | POOL_MMAP_HUGETLB)) && bytes % (2u << 20)
+			&& (2u << 20) - bytes % (2u << 20) >= pool_ptr.elementSize)
+		return FAILURE;
+
+	for(i = 0; i < MMAP_COUNT; i++) {
+		ptrs[i] = poolMalloc(&pool_ptr);
+		if(ptrs[i] == NULL)
+			return FAILURE;
+		if((flags & POOL_MMAP_CACHELINE) && (uintptr_t)ptrs[i] % POOL_CACHE_LINE)
+			return FAILURE;
+		memset(ptrs[i], i, 40);
+	}
+
+	for(i = 0; i < MMAP_COUNT; i++) {
+		if(ptrs[i][39] != (uint8_t)i)
+			return FAILURE;
+		poolFree(&pool_ptr, ptrs[i]);
+	}
+
+	poolTrim(&pool_ptr);
+	poolFreePool(&pool_ptr);
+	free(ptrs);
+
+	return SUCCESS;
+}
+
+static int count_chunks(arena *a)
+{
+	arenaChunk *c;
+	int n = 0;
+
+	for(c = a->head; c != NULL; c = c->next)
+		n++;
+
+	return n;
+}
+
+int test_arena(void)
+{
+	arena arena_ptr;
+	arenaMarker mark;
+	uint8_t *p, *q, *first;
+	int i, chunks;
+
+	arenaInitialize(&arena_ptr, 1024);
+
+	/* per call alignment, and objects never overlap */
+	q = NULL;
+	for(i = 0; i < 100; i++) {
+		p = arenaMalloc(&arena_ptr, 1 + i % 50, (size_t)1 << (i % 7));
+		if(p == NULL || (uintptr_t)p % ((size_t)1 << (i % 7)) || (q != NULL && p < q && p + 50 > q))
+			return FAILURE;
+		memset(p, i, 1 + i % 50);
+		q = p;
+	}
+
+	/* larger than a chunk gets a chunk of its own */
+	p = arenaMalloc(&arena_ptr, 5000, 64);
+	if(p == NULL || (uintptr_t)p % 64)
+		return FAILURE;
+	memset(p, 0xab, 5000);
+
+	/* everything after the mark goes, everything before stays */
+	q = arenaMalloc(&arena_ptr, 16, ARENA_ALIGN);
+	mark = arenaMark(&arena_ptr);
+	for(i = 0; i < 200; i++)
+		arenaMalloc(&arena_ptr, 100, 8);
+	chunks = count_chunks(&arena_ptr);
+	arenaRewind(&arena_ptr, mark);
+	if(arenaMalloc(&arena_ptr, 16, ARENA_ALIGN) != q + 16 || p[4999] != 0xab)
+		return FAILURE;
+
+	/* after a reset the same chunks are filled again, in order */
+	arenaReset(&arena_ptr);
+	first = arenaMalloc(&arena_ptr, 8, 8);
+	if(first != arena_ptr.head->data)
+		return FAILURE;
+	for(i = 0; i < 200; i++)
+		if(arenaMalloc(&arena_ptr, 100, 8) == NULL)
+			return FAILURE;
+	if(count_chunks(&arena_ptr) != chunks)
+		return FAILURE;
+
+	arenaFreeArena(&arena_ptr);
+
+	return SUCCESS;
+}
+
+#define STATIC_CAPACITY 1000
+
+/* list node linked by 16-bit handles: 4 bytes instead of 16 with pointers */
+typedef struct {
+	uint16_t next;
+	uint16_t value;
+} listNode;
+
+POOL_STATIC_DEFINE(nodePool, listNode, uint16_t, STATIC_CAPACITY)
+POOL_STATIC_DEFINE(wordPool, uint32_t, uint32_t, 70000)
+
+static nodePool nodes;
+static wordPool words;
+
+int test_pool_static(void)
+{
+	nodePoolHandle h, head = POOL_STATIC_NULL;
+	wordPoolHandle w;
+	int i, n;
+
+	if(sizeof(nodes.slots[0]) != sizeof(listNode))
+		return FAILURE;
+
+	/* a static instance is ready as is: fill it to capacity */
+	for(i = 0; i < STATIC_CAPACITY; i++) {
+		h = nodePoolMalloc(&nodes);
+		if(h == POOL_STATIC_NULL)
+			return FAILURE;
+		nodePoolGet(&nodes, h)->value = i;
+		nodePoolGet(&nodes, h)->next = head;
+		head = h;
+	}
+	if(nodePoolMalloc(&nodes) != POOL_STATIC_NULL)
+		return FAILURE;
+
+	/* walk the list, freeing every other node */
+	for(h = head, n = STATIC_CAPACITY - 1; h != POOL_STATIC_NULL; n--) {
+		nodePoolHandle next = nodePoolGet(&nodes, h)->next;
+
+		if(nodePoolGet(&nodes, h)->value != n)
+			return FAILURE;
+		if(n % 2)
+			nodePoolFree(&nodes, h);
+		h = next;
+	}
+
+	/* exactly the freed half comes back */
+	for(i = 0; i < STATIC_CAPACITY / 2; i++)
+		if(nodePoolMalloc(&nodes) == POOL_STATIC_NULL)
+			return FAILURE;
+	if(nodePoolMalloc(&nodes) != POOL_STATIC_NULL)
+		return FAILURE;
+
+	nodePoolFreeAll(&nodes);
+	if(nodePoolMalloc(&nodes) != 1)
+		return FAILURE;
+
+	/* 32-bit handles past the 16-bit range */
+	for(i = 0; i < 70000; i++) {
+		w = wordPoolMalloc(&words);
+		if(w == POOL_STATIC_NULL)
+			return FAILURE;
+		*wordPoolGet(&words, w) = i;
+	}
+	if(*wordPoolGet(&words, 69999 + 1) != 69999)
+		return FAILURE;
+
+	return SUCCESS;
+}
+
+#ifdef POOL_STATS
+int test_pool_stats(void)
+{
+	pool pool_ptr;
+	void *ptrs[1000];
+	char *dump = NULL;
+	size_t dump_size;
+	FILE *out;
+	uint64_t samples = 0;
+	static char site;
+	int i;
+
+	poolInitialize(&pool_ptr, 32, 100);
+
+	for(i = 0; i < 1000; i++)
+		ptrs[i] = poolMalloc(&pool_ptr);
+	for(i = 0; i < 600; i++)
+		poolFree(&pool_ptr, ptrs[i]);
+	poolMallocBatch(&pool_ptr, ptrs, 100);
+
+	if(pool_ptr.stats.allocs != 1100 || pool_ptr.stats.frees != 600 || pool_ptr.stats.live != 500
+			|| pool_ptr.stats.peakLive != 1000 || pool_ptr.stats.blocks != 10 || pool_ptr.freeCount != 500)
+		return FAILURE;
+
+	/* one allocation in POOL_STATS_SAMPLE is attributed to its caller */
+	for(i = 0; i < POOL_STATS_SITES; i++)
+		samples += pool_ptr.stats.sites[i].samples;
+	if(samples != 1100 / POOL_STATS_SAMPLE)
+		return FAILURE;
+
+	out = open_memstream(&dump, &dump_size);
+	poolStatsDump(&pool_ptr, out);
+	fclose(out);
+	if(strstr(dump, "live 500 (peak 1000), blocks 10, free list 500") == NULL)
+		return FAILURE;
+	free(dump);
+
+	/* a layer on top of the pool passes its own caller as the site */
+	poolMallocBatchFrom(&pool_ptr, ptrs, POOL_STATS_SAMPLE, &site);
+	for(i = 0; i < POOL_STATS_SITES; i++)
+		if(pool_ptr.stats.sites[i].site == &site)
+			break;
+	if(i == POOL_STATS_SITES)
+		return FAILURE;
+
+	poolFreePool(&pool_ptr);
+
+	return SUCCESS;
+}
+#endif
+
+#define MT_ROUNDS 200
+#define MT_LIVE 100
+
+typedef struct {
+	poolMt *p;
+	uintptr_t id;
+	int result;
+} mtArg;
+
+static void *test_pool_mt_thread(void *arg)
+{
+	mtArg *a = arg;
+	uintptr_t *live[MT_LIVE];
+	int round, i;
+
+	a->result = SUCCESS;
+	for(round = 0; round < MT_ROUNDS; round++) {
+		for(i = 0; i < MT_LIVE; i++) {
+			live[i] = poolMtMalloc(a->p);
+			if(live[i] == NULL) {
+				a->result = FAILURE;
+				return NULL;
+			}
+			*live[i] = a->id;
+		}
+
+		/* nobody else may have been handed one of our elements */
+		for(i = 0; i < MT_LIVE; i++) {
+			if(*live[i] != a->id)
+				a->result = FAILURE;
+			poolMtFree(a->p, live[i]);
+		}
+	}
+
+	return NULL;
+}
+
+int test_pool_mt(int threads)
+{
+	poolMt pool_mt;
+	pthread_t tid[64];
+	mtArg args[64];
+	int i, result = SUCCESS;
+
+	if(poolMtInitialize(&pool_mt, sizeof(uintptr_t)) != 0)
+		return FAILURE;
+
+	for(i = 0; i < threads; i++) {
+		args[i].p = &pool_mt;
+		args[i].id = i + 1;
+		pthread_create(&tid[i], NULL, test_pool_mt_thread, &args[i]);
+	}
+
+	for(i = 0; i < threads; i++) {
+		pthread_join(tid[i], NULL);
+		if(args[i].result == FAILURE)
+			result = FAILURE;
+	}
+
+	poolMtFreePool(&pool_mt);
+
+	return result;
+}
+
+#define SLAB_LIVE 256
+#define SLAB_TRIM_COUNT 50000
+
+/* spans come back only through xtrim(), never from xfree() itself */
+static int test_slab_trim(void)
+{
+	uint8_t **ptrs = malloc(SLAB_TRIM_COUNT * sizeof(uint8_t *));
+	int i;
+
+	if(ptrs == NULL)
+		return FAILURE;
+
+	for(i = 0; i < SLAB_TRIM_COUNT; i++) {
+		ptrs[i] = xmalloc(200);
+		if(ptrs[i] == NULL)
+			return FAILURE;
+		memset(ptrs[i], i, 200);
+	}
+	for(i = 0; i < SLAB_TRIM_COUNT; i++)
+		xfree(ptrs[i]);
+
+	if(xtrim() == 0 || xtrim() != 0)
+		return FAILURE;
+
+	/* the class still serves allocations after giving its spans back */
+	for(i = 0; i < SLAB_TRIM_COUNT; i++) {
+		ptrs[i] = xmalloc(200);
+		if(ptrs[i] == NULL)
+			return FAILURE;
+		memset(ptrs[i], i, 200);
+	}
+	for(i = 0; i < SLAB_TRIM_COUNT; i++) {
+		if(ptrs[i][199] != (uint8_t)i)
+			return FAILURE;
+		xfree(ptrs[i]);
+	}
+
+	free(ptrs);
+	return SUCCESS;
+}
+
+int test_slab(void)
+{
+	static const size_t sizes[] = { 1, 16, 17, 100, 129, 1000, 4096, 5000, 32768, 32769, 200000 };
+	uint8_t *live[SLAB_LIVE];
+	size_t n, size;
+	uint8_t *p;
+	int i;
+
+	/* every class and the mmap path, each element written end to end */
+	for(i = 0; i < SLAB_LIVE; i++) {
+		size = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+		live[i] = xmalloc(size);
+		if(live[i] == NULL || xmallocUsableSize(live[i]) < size || (uintptr_t)live[i] % SLAB_ALIGN)
+			return FAILURE;
+		memset(live[i], i, size);
+	}
+
+	for(i = 0; i < SLAB_LIVE; i++) {
+		size = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+		for(n = 0; n < size; n++)
+			if(live[i][n] != (uint8_t)i)
+				return FAILURE;
+		xfree(live[i]);
+	}
+
+	/* grow through several classes into mmap, contents must follow */
+	p = NULL;
+	for(size = 8; size <= 100000; size *= 3) {
+		p = xrealloc(p, size);
+		if(p == NULL)
+			return FAILURE;
+		p[size - 1] = (uint8_t)size;
+		for(n = 8; n < size; n *= 3)
+			if(p[n - 1] != (uint8_t)n)
+				return FAILURE;
+	}
+	xfree(p);
+
+	p = xcalloc(10, 100);
+	for(n = 0; n < 1000; n++)
+		if(p == NULL || p[n] != 0)
+			return FAILURE;
+	xfree(p);
+
+	p = xmemalign(64, 40);
+	if(p == NULL || (uintptr_t)p % 64)
+		return FAILURE;
+	xfree(p);
+
+	p = xmemalign(4096, 100);
+	if(p == NULL || (uintptr_t)p % 4096)
+		return FAILURE;
+	xfree(p);
+
+	return test_slab_trim();
+}
+
+#define SLAB_MT_THREADS 4
+#define SLAB_MT_COUNT 20000
+
+typedef struct {
+	uint8_t **handed; /* allocated by main, freed by this thread */
+	int id;
+	int result;
+} slab_mt_arg;
+
+static void *slab_mt_worker(void *arg)
+{
+	slab_mt_arg *a = arg;
+	uint8_t *own[64];
+	size_t size;
+	int i, j;
+
+	a->result = SUCCESS;
+	for(i = 0; i < SLAB_MT_COUNT; i++) {
+		if(a->handed[i][0] != (uint8_t)i)
+			a->result = FAILURE;
+		xfree(a->handed[i]);
+
+		/* short-lived objects of this thread, through its magazines */
+		j = i % 64;
+		if(i >= 64) {
+			if(own[j][0] != (uint8_t)(a->id + j))
+				a->result = FAILURE;
+			xfree(own[j]);
+		}
+		size = 16 + (size_t)(i * 37 % 2000);
+		own[j] = xmalloc(size);
+		if(own[j] == NULL)
+			return NULL;
+		memset(own[j], a->id + j, size);
+	}
+	for(j = 0; j < 64; j++)
+		xfree(own[j]);
+
+	return NULL;
+}
+
+/* frees from other threads, and threads exiting with full magazines */
+int test_slab_threads(void)
+{
+	pthread_t tid[SLAB_MT_THREADS];
+	slab_mt_arg args[SLAB_MT_THREADS];
+	int i, t, result = SUCCESS;
+
+	for(t = 0; t < SLAB_MT_THREADS; t++) {
+		args[t].id = t;
+		args[t].result = FAILURE;
+		args[t].handed = malloc(SLAB_MT_COUNT * sizeof(uint8_t *));
+		if(args[t].handed == NULL)
+			return FAILURE;
+		for(i = 0; i < SLAB_MT_COUNT; i++) {
+			args[t].handed[i] = xmalloc(100);
+			if(args[t].handed[i] == NULL)
+				return FAILURE;
+			memset(args[t].handed[i], i, 100);
+		}
+	}
+
+	for(t = 0; t < SLAB_MT_THREADS; t++)
+		pthread_create(&tid[t], NULL, slab_mt_worker, &args[t]);
+	for(t = 0; t < SLAB_MT_THREADS; t++) {
+		pthread_join(tid[t], NULL);
+		if(args[t].result == FAILURE)
+			result = FAILURE;
+		free(args[t].handed);
+	}
+
+	return result;
+}
+
+#define SLAB_FORK_THREADS 4
+#define SLAB_FORKS 200
+
+static _Atomic int slab_fork_stop;
+
+static void *slab_fork_worker(void *arg)
+{
+	void *p;
+
+	(void)arg;
+	while(!atomic_load_explicit(&slab_fork_stop, memory_order_relaxed)) {
+		p = xmalloc(48);
+		xfree(p);
+	}
+
+	return NULL;
+}
+
+/* fork() while other threads hammer a class: the child must still allocate from it */
+int test_slab_fork(void)
+{
+	pthread_t tid[SLAB_FORK_THREADS];
+	int i, status, result = SUCCESS;
+	pid_t pid;
+
+	xfree(xmalloc(48));
+	atomic_store(&slab_fork_stop, 0);
+	for(i = 0; i < SLAB_FORK_THREADS; i++)
+		pthread_create(&tid[i], NULL, slab_fork_worker, NULL);
+
+	for(i = 0; i < SLAB_FORKS && result == SUCCESS; i++) {
+		pid = fork();
+		if(pid == 0) {
+			alarm(5); /* a lock inherited in the locked state hangs here */
+			xfree(xmalloc(48));
+			_exit(0);
+		}
+		if(pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status))
+			result = FAILURE;
+	}
+
+	atomic_store(&slab_fork_stop, 1);
+	for(i = 0; i < SLAB_FORK_THREADS; i++)
+		pthread_join(tid[i], NULL);
+
+	return result;
+}
+
 int main()
 {
 	if(test_pool(4, 8) == FAILURE)
@@ -48,6 +683,59 @@ int main()
 
 	if(test_pool(32, 8) == FAILURE)
 		printf("test_pool failure %s %d \n", __FILE__, __LINE__);
+
+	if(test_pool_batch(8, 8) == FAILURE)
+		printf("test_pool_batch failure %s %d \n", __FILE__, __LINE__);
+
+	if(test_pool_batch(32, 64) == FAILURE)
+		printf("test_pool_batch failure %s %d \n", __FILE__, __LINE__);
+
+	if(test_pool_trim(-1) == FAILURE)
+		printf("test_pool_trim failure %s %d \n", __FILE__, __LINE__);
+
+	if(test_pool_trim(0) == FAILURE)
+		printf("test_pool_trim failure %s %d \n", __FILE__, __LINE__);
+
+	if(test_pool_trim(POOL_MMAP_DONTNEED) == FAILURE)
+		printf("test_pool_trim failure %s %d \n", __FILE__, __LINE__);
+
+	if(test_pool_mmap(POOL_MMAP_CACHELINE) == FAILURE)
+		printf("test_pool_mmap failure %s %d \n", __FILE__, __LINE__);
+
+	if(test_pool_mmap(POOL_MMAP_HUGE | POOL_MMAP_NUMA_LOCAL | POOL_MMAP_DONTNEED) == FAILURE)
+		printf("test_pool_mmap failure %s %d \n", __FILE__, __LINE__);
+
+	if(test_pool_mmap(POOL_MMAP_HUGETLB | POOL_MMAP_CACHELINE) == FAILURE)
+		printf("test_pool_mmap failure %s %d \n", __FILE__, __LINE__);
+
+	if(test_arena() == FAILURE)
+		printf("test_arena failure %s %d \n", __FILE__, __LINE__);
+
+	if(test_pool_static() == FAILURE)
+		printf("test_pool_static failure %s %d \n", __FILE__, __LINE__);
+
+#ifdef POOL_STATS
+	if(test_pool_stats() == FAILURE)
+		printf("test_pool_stats failure %s %d \n", __FILE__, __LINE__);
+#endif
+
+	if(test_pool_mt(1) == FAILURE)
+		printf("test_pool_mt failure %s %d \n", __FILE__, __LINE__);
+
+	if(test_pool_mt(8) == FAILURE)
+		printf("test_pool_mt failure %s %d \n", __FILE__, __LINE__);
+
+	if(test_pool_mt(64) == FAILURE)
+		printf("test_pool_mt failure %s %d \n", __FILE__, __LINE__);
+
+	if(test_slab() == FAILURE)
+		printf("test_slab failure %s %d \n", __FILE__, __LINE__);
+
+	if(test_slab_threads() == FAILURE)
+		printf("test_slab_threads failure %s %d \n", __FILE__, __LINE__);
+
+	if(test_slab_fork() == FAILURE)
+		printf("test_slab_fork failure %s %d \n", __FILE__, __LINE__);
   
 
 	return SUCCESS;
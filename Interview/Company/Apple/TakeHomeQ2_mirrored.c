@@ -0,0 +1,214 @@
+/*
+Question 2 follow-up
+
+The circular buffer in TakeHomeQ2.c has to split every enqueue/dequeue
+into part1/part2 memcpys at the wrap boundary. This version maps the
+same physical pages twice, back to back:
+
+   virtual:  [ buf[0 .. size) ][ buf[size .. 2*size) ]
+   physical: [   memfd pages  ][   same memfd pages  ]
+
+so buf[i] and buf[i + size] are the same byte. Any span of up to size
+bytes starting inside the first mapping is contiguous in virtual memory,
+every copy is one memcpy and a parser can run directly on the buffer
+without reassembling a wrapped message.
+
+Build: gcc -Wall -o TakeHomeQ2_mirrored TakeHomeQ2_mirrored.c
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define BUF_SIZE            (4096)
+
+#define CB_SUCCESS          (0)
+#define CB_ERR_OVERFLOW     (2)
+#define CB_ERR_NOMEM        (4)
+
+typedef struct {
+   size_t write_index;  // offset in [0, size)
+   size_t read_index;   // offset in [0, size)
+   size_t used;         // bytes currently queued
+   char *buf;           // 2 * size bytes of address space, mirrored
+   size_t size;         // multiple of the page size
+} circular_buf_t;
+
+static char *GetErrorString(int x)
+{
+   switch (x) {
+      case CB_SUCCESS:
+         return "Success -- No error.";
+      case CB_ERR_OVERFLOW:
+         return "Overflow!";
+      case CB_ERR_NOMEM:
+         return "Out of memory!";
+      default:
+         return "Unknown error!";
+   }
+}
+
+/*
+* Map a memfd of (size) bytes twice, back to back. (size) is rounded up
+* to the page size since mappings are page granular.
+*/
+int circular_buf_init(circular_buf_t *cb, size_t size)
+{
+   size_t page = (size_t)sysconf(_SC_PAGESIZE);
+   char *addr;
+   int fd;
+
+   size = (size + page - 1) & ~(page - 1);
+
+   fd = memfd_create("circular_buf", MFD_CLOEXEC);
+   if (fd < 0)
+      return CB_ERR_NOMEM;
+
+   if (ftruncate(fd, size) < 0) {
+      close(fd);
+      return CB_ERR_NOMEM;
+   }
+
+   // reserve 2 * size of contiguous address space first ...
+   addr = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (addr == MAP_FAILED) {
+      close(fd);
+      return CB_ERR_NOMEM;
+   }
+
+   // ... then put the same file pages over both halves
+   if (mmap(addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+       mmap(addr + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+      munmap(addr, 2 * size);
+      close(fd);
+      return CB_ERR_NOMEM;
+   }
+
+   // the mappings keep the pages alive
+   close(fd);
+
+   cb->buf = addr;
+   cb->size = size;
+   cb->write_index = 0;
+   cb->read_index = 0;
+   cb->used = 0;
+
+   return CB_SUCCESS;
+}
+
+void circular_buf_free(circular_buf_t *cb)
+{
+   munmap(cb->buf, 2 * cb->size);
+   cb->buf = NULL;
+}
+
+/*
+* Enqueue (size) bytes from (client_buf), all or nothing
+*/
+int enqueue(circular_buf_t *cb, const char *client_buf, size_t size)
+{
+   if (size > cb->size - cb->used) {
+      printf("%s\n", GetErrorString(CB_ERR_OVERFLOW));
+      return CB_ERR_OVERFLOW;
+   }
+
+   // never split: the mirror absorbs the wrap
+   memcpy(cb->buf + cb->write_index, client_buf, size);
+
+   cb->write_index += size;
+   if (cb->write_index >= cb->size)
+      cb->write_index -= cb->size;
+   cb->used += size;
+
+   return CB_SUCCESS;
+}
+
+/*
+* Dequeue up to (size) bytes into (client_buf), return the bytes copied
+*/
+size_t dequeue(circular_buf_t *cb, char *client_buf, size_t size)
+{
+   if (size > cb->used)
+      size = cb->used;
+
+   memcpy(client_buf, cb->buf + cb->read_index, size);
+
+   cb->read_index += size;
+   if (cb->read_index >= cb->size)
+      cb->read_index -= cb->size;
+   cb->used -= size;
+
+   return size;
+}
+
+/*
+* Zero-copy access for parsers: all queued bytes as one contiguous span
+*/
+const char *circular_buf_peek(circular_buf_t *cb, size_t *len)
+{
+   *len = cb->used;
+   return cb->buf + cb->read_index;
+}
+
+void circular_buf_consume(circular_buf_t *cb, size_t size)
+{
+   if (size > cb->used)
+      size = cb->used;
+
+   cb->read_index += size;
+   if (cb->read_index >= cb->size)
+      cb->read_index -= cb->size;
+   cb->used -= size;
+}
+
+
+int main(int argc, char *argv[])
+{
+   circular_buf_t buf;
+   char in[BUF_SIZE], out[BUF_SIZE];
+   const char *span;
+   size_t len, i;
+   int ret;
+
+   ret = circular_buf_init(&buf, BUF_SIZE);
+   if (ret != CB_SUCCESS) {
+      printf("%s\n", GetErrorString(ret));
+      return EXIT_FAILURE;
+   }
+
+   for (i = 0; i < sizeof(in); i++)
+      in[i] = (char)i;
+
+   // move the indices close to the end of the buffer
+   enqueue(&buf, in, 3000);
+   dequeue(&buf, out, 3000);
+
+   // this message wraps around the end of the physical buffer
+   enqueue(&buf, in, 3000);
+
+   // but the parser still sees it as one span
+   span = circular_buf_peek(&buf, &len);
+   if (len != 3000 || memcmp(span, in, len) != 0) {
+      printf("mirrored peek mismatch\n");
+      return EXIT_FAILURE;
+   }
+
+   if (dequeue(&buf, out, sizeof(out)) != 3000 || memcmp(out, in, 3000) != 0) {
+      printf("mirrored dequeue mismatch\n");
+      return EXIT_FAILURE;
+   }
+
+   // overflow is rejected, not truncated
+   if (enqueue(&buf, in, BUF_SIZE + 1) != CB_ERR_OVERFLOW)
+      return EXIT_FAILURE;
+
+   printf("wrapped enqueue/dequeue done with single memcpys\n");
+
+   circular_buf_free(&buf);
+
+   return 0;
+}